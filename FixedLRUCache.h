@@ -0,0 +1,412 @@
+// FixedLRUCache.h:
+// An LRU cache of compile-time capacity, with all of its storage inline
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// FixedLRUCache<TKey, TValue, Capacity> has the get()/peek()/put() surface of
+// LRUCache (strict LRU, no policies, TTLs or weights) but never allocates:
+// the entries, their recency links and the index are arrays inside the
+// object, so a small one can live on the stack or in a per-connection struct
+// and stay in L1.
+//
+// Links are the narrowest unsigned type that can number Capacity slots plus
+// a "none" value: 8 bits up to 254 entries, 16 up to 65534. Up to 64 entries
+// the index is a byte per slot holding 7 bits of the key's hash, scanned 16
+// at a time with SSE2 where available (one byte at a time elsewhere); keys
+// are only compared where the byte matches. Larger caches use an open-
+// addressing table of slot numbers, at most half full.
+//
+#ifndef FIXEDLRUCACHE_H
+#define FIXEDLRUCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FIXEDLRU_SSE2 1
+#endif
+
+#include "LRUStats.h"
+
+namespace lru_detail {
+    // The narrowest link type for N slots and a none value.
+    template<std::size_t N>
+    struct fixed_link {
+        typedef typename std::conditional<(N < 0xFF), std::uint8_t,
+                typename std::conditional<(N < 0xFFFF), std::uint16_t, std::uint32_t>::type>::type type;
+    };
+
+    constexpr std::size_t pow2_at_least(std::size_t n, std::size_t p = 1) {
+        return p >= n ? p : pow2_at_least(n, p * 2);
+    }
+
+    constexpr unsigned log2_of(std::size_t p) { return p <= 1 ? 0 : 1 + log2_of(p / 2); }
+
+    inline unsigned count_trailing_zeros(unsigned x) {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<unsigned>(__builtin_ctz(x));
+#else
+        unsigned n = 0;
+        for (; !(x & 1); x >>= 1)
+            ++n;
+        return n;
+#endif
+    }
+}
+
+template<class TKey, class TValue, std::size_t Capacity,
+         class THash = std::hash<TKey>, class TKeyEqual = std::equal_to<TKey>,
+         class TStats = LRUStats<> >
+class FixedLRUCache {
+    static_assert(Capacity > 0 && Capacity < 0xFFFFFFFFu, "FixedLRUCache capacity must be between 1 and 2^32 - 2");
+    // Evicting moves the new entry into the tail's slot once that is out of
+    // the index and the list, where a throw would lose the slot.
+    static_assert(std::is_nothrow_move_assignable< std::pair<TKey, TValue> >::value ||
+                  std::is_nothrow_move_constructible< std::pair<TKey, TValue> >::value,
+                  "FixedLRUCache keys and values must move (assign or construct) without throwing");
+
+public:
+    typedef std::pair<TKey, TValue>                        value_type;
+    typedef const value_type&                              const_reference;
+    typedef std::size_t                                    size_type;
+    typedef TKey                                           key_type;
+    typedef TValue                                         mapped_type;
+    typedef THash                                          hasher;
+    typedef TKeyEqual                                      key_equal;
+    typedef TStats                                         stats_type;
+    typedef typename lru_detail::fixed_link<Capacity>::type link_type;
+
+private:
+    static const link_type npos = link_type(-1);
+
+    // Up to 64 entries: tags scanned linearly. Beyond: a hash table.
+    static const bool        tagged = Capacity <= 64;
+    static const std::size_t tag_bytes = tagged ? (Capacity + 15) / 16 * 16 : 1;
+    static const std::size_t table_size = tagged ? 1 : lru_detail::pow2_at_least(2 * Capacity);
+    static const unsigned    table_shift = 64 - lru_detail::log2_of(table_size);
+
+    struct slot {
+        alignas(value_type) unsigned char storage[sizeof(value_type)];
+        link_type prev;                 // towards the front (more recent)
+        link_type next;
+    };
+
+public:
+    class const_iterator {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef typename FixedLRUCache::value_type value_type;
+        typedef std::ptrdiff_t                  difference_type;
+        typedef const value_type*               pointer;
+        typedef const value_type&               reference;
+
+        const_iterator() : cache_(nullptr), at_(npos) {}
+
+        inline reference operator*() const  { return cache_->kv(at_); }
+        inline pointer   operator->() const { return &cache_->kv(at_); }
+
+        inline const_iterator& operator++() { at_ = cache_->slots_[at_].next; return *this; }
+        inline const_iterator& operator--() {
+            at_ = at_ == npos ? cache_->tail_ : cache_->slots_[at_].prev;
+            return *this;
+        }
+        inline const_iterator operator++(int) { const_iterator t = *this; ++*this; return t; }
+        inline const_iterator operator--(int) { const_iterator t = *this; --*this; return t; }
+
+        inline bool operator==(const const_iterator& other) const { return at_ == other.at_; }
+        inline bool operator!=(const const_iterator& other) const { return at_ != other.at_; }
+
+    private:
+        friend class FixedLRUCache;
+        const_iterator(const FixedLRUCache* cache, link_type at) : cache_(cache), at_(at) {}
+
+        const FixedLRUCache* cache_;
+        link_type            at_;
+    };
+
+    explicit FixedLRUCache(const hasher& hash = hasher(), const key_equal& equal = key_equal())
+        : hash_(hash), equal_(equal), head_(npos), tail_(npos), size_(0)
+    {
+        clear_index();
+    }
+
+    // Copies entries one by one, from least to most recent, so the copy has
+    // the same order.
+    FixedLRUCache(const FixedLRUCache& other)
+        : hash_(other.hash_), equal_(other.equal_), head_(npos), tail_(npos), size_(0), stats_(other.stats_)
+    {
+        clear_index();
+        copy_from(other);
+    }
+
+    FixedLRUCache& operator=(const FixedLRUCache& other) {
+        if (this != &other){
+            clear();
+            hash_ = other.hash_;
+            equal_ = other.equal_;
+            stats_ = other.stats_;
+            copy_from(other);
+        }
+        return *this;
+    }
+
+    ~FixedLRUCache() { destroy_all(); }
+
+    const_iterator get(const TKey& key) {
+        lru_detail::stopwatch<stats_type::timed> watch;
+        std::uint64_t h = mix(key);
+        link_type s = find(key, h);
+        const_iterator pos = end();
+        if (s != npos){
+            stats_.count_hit();
+            move_to_front(s);
+            pos = const_iterator(this, s);
+        }
+        else{
+            stats_.count_miss();
+        }
+        stats_.time_get(watch.elapsed());
+        return pos;
+    }
+
+    const_iterator peek(const TKey& key) const {
+        return const_iterator(this, find(key, mix(key)));
+    }
+
+    inline bool is_cached(const TKey& key) const { return find(key, mix(key)) != npos; }
+
+    // Inserts key/value, or replaces the value of an existing key in place.
+    // Returns true if the key was newly inserted, false if it replaced an existing value.
+    template<class V = TValue>
+    bool put(const TKey& key, V&& value) {
+        return put_impl(key, std::forward<V>(value));
+    }
+
+    template<class V = TValue>
+    bool put(TKey&& key, V&& value) {
+        return put_impl(std::move(key), std::forward<V>(value));
+    }
+
+    inline const_iterator  begin() const { return const_iterator(this, head_); }
+    inline const_iterator  end() const   { return const_iterator(this, npos);  }
+    inline const_reference front() const { return kv(head_); }
+    inline const_reference back() const  { return kv(tail_); }
+
+    inline bool empty() const                      { return size_ == 0; }
+    inline size_type size() const                  { return size_;      }
+    static constexpr size_type max_size()          { return Capacity;   }
+
+    void clear() {
+        destroy_all();
+        head_ = tail_ = npos;
+        size_ = 0;
+        clear_index();
+    }
+
+    inline unsigned long long cache_hits()   const { return stats_.snapshot().hits;    }
+    inline unsigned long long cache_misses() const { return stats_.snapshot().misses;  }
+    inline unsigned long long update_count() const { return stats_.snapshot().updates; }
+    inline unsigned long long bounce_count() const { return stats_.snapshot().bounces; }
+
+    inline LRUStatsSnapshot stats() const { return stats_.snapshot(); }
+    inline LRUStatsSnapshot reset_stats() { return stats_.reset();    }
+
+private:
+    inline value_type&       kv(link_type s)       { return *reinterpret_cast<value_type*>(slots_[s].storage);       }
+    inline const value_type& kv(link_type s) const { return *reinterpret_cast<const value_type*>(slots_[s].storage); }
+
+    inline std::uint64_t mix(const TKey& key) const {
+        return static_cast<std::uint64_t>(hash_(key)) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    static inline unsigned char tag_of(std::uint64_t h) { return static_cast<unsigned char>((h >> 57) + 1); }
+    inline std::size_t home_of(std::uint64_t h) const   { return static_cast<std::size_t>(h >> table_shift); }
+
+    inline link_type find(const TKey& key, std::uint64_t h) const {
+        return find(key, h, std::integral_constant<bool, tagged>());
+    }
+
+    // Slots [0, size_) are all in use: entries are only ever added at size_
+    // or swapped in for the one evicted.
+    link_type find(const TKey& key, std::uint64_t h, std::true_type) const {
+        unsigned char tag = tag_of(h);
+#ifdef FIXEDLRU_SSE2
+        const __m128i want = _mm_set1_epi8(static_cast<char>(tag));
+        for (std::size_t i = 0; i < size_; i += 16){
+            __m128i have = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags_ + i));
+            unsigned match = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(have, want)));
+            if (size_ - i < 16)
+                match &= (1u << (size_ - i)) - 1;
+            while (match){
+                std::size_t s = i + lru_detail::count_trailing_zeros(match);
+                if (equal_(kv(static_cast<link_type>(s)).first, key))
+                    return static_cast<link_type>(s);
+                match &= match - 1;
+            }
+        }
+#else
+        for (std::size_t s = 0; s < size_; ++s){
+            if (tags_[s] == tag && equal_(kv(static_cast<link_type>(s)).first, key))
+                return static_cast<link_type>(s);
+        }
+#endif
+        return npos;
+    }
+
+    link_type find(const TKey& key, std::uint64_t h, std::false_type) const {
+        for (std::size_t i = home_of(h);; i = (i + 1) & (table_size - 1)){
+            link_type s = table_[i];
+            if (s == npos || equal_(kv(s).first, key))
+                return s;
+        }
+    }
+
+    inline void index(link_type s, std::uint64_t h) { index(s, h, std::integral_constant<bool, tagged>()); }
+
+    inline void index(link_type s, std::uint64_t h, std::true_type) { tags_[s] = tag_of(h); }
+
+    inline void index(link_type s, std::uint64_t h, std::false_type) {
+        std::size_t i = home_of(h);
+        while (table_[i] != npos)
+            i = (i + 1) & (table_size - 1);
+        table_[i] = s;
+    }
+
+    inline void unindex(link_type s) { unindex(s, std::integral_constant<bool, tagged>()); }
+
+    inline void unindex(link_type, std::true_type) {}          // the slot is refilled and retagged at once
+
+    // Backward-shift deletion: no tombstones, so probes stay short.
+    void unindex(link_type s, std::false_type) {
+        std::size_t mask = table_size - 1;
+        std::size_t hole = home_of(mix(kv(s).first));
+        while (table_[hole] != s)
+            hole = (hole + 1) & mask;
+        for (std::size_t i = (hole + 1) & mask; table_[i] != npos; i = (i + 1) & mask){
+            std::size_t home = home_of(mix(kv(table_[i]).first));
+            if (((i - home) & mask) >= ((i - hole) & mask)){
+                table_[hole] = table_[i];
+                hole = i;
+            }
+        }
+        table_[hole] = npos;
+    }
+
+    // Tags past size_ are never matched, but are scanned, so start them at 0.
+    inline void clear_index() {
+        for (std::size_t i = 0; i < tag_bytes; ++i)
+            tags_[i] = 0;
+        for (std::size_t i = 0; i < table_size; ++i)
+            table_[i] = npos;
+    }
+
+    inline void unlink(link_type s) {
+        if (slots_[s].prev != npos)
+            slots_[slots_[s].prev].next = slots_[s].next;
+        else
+            head_ = slots_[s].next;
+        if (slots_[s].next != npos)
+            slots_[slots_[s].next].prev = slots_[s].prev;
+        else
+            tail_ = slots_[s].prev;
+    }
+
+    inline void link_front(link_type s) {
+        slots_[s].prev = npos;
+        slots_[s].next = head_;
+        if (head_ != npos)
+            slots_[head_].prev = s;
+        else
+            tail_ = s;
+        head_ = s;
+    }
+
+    inline void move_to_front(link_type s) {
+        if (s == head_)
+            return;
+        unlink(s);
+        link_front(s);
+    }
+
+    template<class K, class V>
+    bool put_impl(K&& key, V&& value) {
+        lru_detail::stopwatch<stats_type::timed> watch;
+        std::uint64_t h = mix(key);
+        link_type s = find(key, h);
+        if (s != npos){
+            stats_.count_update();
+            kv(s).second = std::forward<V>(value);
+            move_to_front(s);
+            stats_.time_put(watch.elapsed());
+            return false;
+        }
+        if (size_ < Capacity){
+            s = static_cast<link_type>(size_);
+            new (slots_[s].storage) value_type(std::forward<K>(key), std::forward<V>(value));
+            ++size_;
+        }
+        else{
+            // built first, so a throwing constructor leaves the cache as it
+            // was; moving it into the slot can't throw
+            value_type fresh(std::forward<K>(key), std::forward<V>(value));
+            stats_.count_bounce();
+            s = tail_;
+            unindex(s);
+            unlink(s);
+            replace(s, std::move(fresh), std::integral_constant<bool, std::is_nothrow_move_assignable<value_type>::value>());
+        }
+        index(s, h);
+        link_front(s);
+        stats_.time_put(watch.elapsed());
+        return true;
+    }
+
+    inline void replace(link_type s, value_type&& fresh, std::true_type) { kv(s) = std::move(fresh); }
+
+    inline void replace(link_type s, value_type&& fresh, std::false_type) {
+        kv(s).~value_type();
+        new (slots_[s].storage) value_type(std::move(fresh));
+    }
+
+    void copy_from(const FixedLRUCache& other) {
+        for (link_type s = other.tail_; s != npos; s = other.slots_[s].prev){
+            const value_type& e = other.kv(s);
+            link_type d = static_cast<link_type>(size_);
+            new (slots_[d].storage) value_type(e);
+            ++size_;
+            index(d, mix(e.first));
+            link_front(d);
+        }
+    }
+
+    void destroy_all() {
+        if (std::is_trivially_destructible<value_type>::value)
+            return;
+        for (std::size_t s = 0; s < size_; ++s)
+            kv(static_cast<link_type>(s)).~value_type();
+    }
+
+    hasher             hash_;
+    key_equal          equal_;
+    link_type          head_;
+    link_type          tail_;
+    size_type          size_;
+    slot               slots_[Capacity];
+    unsigned char      tags_[tag_bytes];        // up to 64 entries: one per slot
+    link_type          table_[table_size];      // beyond: slot numbers, npos if empty
+    stats_type         stats_;
+};
+
+#endif // FIXEDLRUCACHE_H
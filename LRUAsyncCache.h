@@ -0,0 +1,243 @@
+// LRUAsyncCache.h:
+// A C++20 coroutine front-end to LRUCache whose misses load without blocking
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+//     Blob blob = co_await cache.co_get_or_load(key, [](const std::string& k) { return fetch(k); });
+//
+// co_get_or_load() is an awaitable. On a hit it is ready at once and the
+// awaiting coroutine carries straight on, without suspending or allocating.
+// On a miss the awaiting coroutine suspends, and the loader - a function
+// returning an awaitable for the value, e.g. a network call - is started.
+// Further misses on the same key while it is in flight suspend on that same
+// load rather than start their own. When the load completes the value is
+// put() in the cache and every waiter is resumed with a copy of it (or with
+// the loader's exception), in the order they arrived, on the thread that
+// completed the load. No executor thread ever blocks on a miss.
+//
+// The cache and the in-flight loads are guarded by one mutex, held only for
+// the lookup and the bookkeeping, never across a suspension or a resumption.
+// The LRUAsyncCache must outlive any load it has started.
+//
+#ifndef LRUASYNCCACHE_H
+#define LRUASYNCCACHE_H
+
+#include "LRUCache.h"
+
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace lru_detail {
+    // A coroutine that starts at once and cleans up after itself: what runs
+    // a load, which nobody awaits directly. The body catches everything.
+    struct detached {
+        struct promise_type {
+            detached            get_return_object() noexcept { return detached(); }
+            std::suspend_never  initial_suspend() noexcept   { return {}; }
+            std::suspend_never  final_suspend() noexcept     { return {}; }
+            void                return_void() noexcept       {}
+            void                unhandled_exception() noexcept { std::terminate(); }
+        };
+    };
+}
+
+template<class TKey, class TValue, class TCache = LRUCache<TKey, TValue> >
+class LRUAsyncCache {
+    // A load in progress and the coroutines waiting for it.
+    struct flight {
+        flight() : done(false) {}
+
+        bool                                 done;
+        std::optional<TValue>                value;
+        std::exception_ptr                   error;
+        std::vector<std::coroutine_handle<>> waiters;
+    };
+
+    typedef std::unordered_map<TKey, std::shared_ptr<flight>,
+                               typename TCache::hasher, typename TCache::key_equal> flight_map;
+
+public:
+    typedef TCache                                         cache_type;
+    typedef typename cache_type::size_type                 size_type;
+
+    explicit LRUAsyncCache(size_type size, LRUPolicy policy = LRUPolicy::strict) : cache_(size, policy) {}
+
+    // What co_get_or_load() returns; co_await it for the value.
+    template<class F>
+    class load_awaiter {
+    public:
+        load_awaiter(LRUAsyncCache& owner, TKey key, F loader)
+            : owner_(owner), key_(std::move(key)), loader_(std::move(loader)), leader_(false)
+        {}
+
+        bool await_ready() {
+            std::lock_guard<std::mutex> lock(owner_.lock_);
+            auto pos = owner_.cache_.get(key_);
+            if (pos != owner_.cache_.end()){
+                hit_.emplace(pos->second);
+                return true;
+            }
+            auto found = owner_.flights_.find(key_);
+            if (found != owner_.flights_.end()){
+                flight_ = found->second;
+            }
+            else{
+                flight_ = std::make_shared<flight>();
+                owner_.flights_.emplace(key_, flight_);
+                leader_ = true;
+            }
+            return false;
+        }
+
+        // Doesn't suspend after all if the load has finished meanwhile -
+        // the leader's own loader may complete before it first suspends.
+        // A load that fails to start at all (its frame, or the copies into
+        // it, threw) fails the flight like a loader that threw.
+        bool await_suspend(std::coroutine_handle<> waiter) {
+            if (leader_){
+                try{
+                    owner_.load(key_, std::move(loader_), flight_);
+                }
+                catch (...){
+                    std::optional<TValue> none;
+                    owner_.land(key_, flight_, none, std::current_exception());
+                    return false;
+                }
+            }
+            std::lock_guard<std::mutex> lock(owner_.lock_);
+            if (flight_->done)
+                return false;
+            flight_->waiters.push_back(waiter);
+            return true;
+        }
+
+        TValue await_resume() {
+            if (hit_)
+                return std::move(*hit_);
+            if (flight_->error)
+                std::rethrow_exception(flight_->error);
+            return *flight_->value;
+        }
+
+    private:
+        LRUAsyncCache&          owner_;
+        TKey                    key_;
+        F                       loader_;
+        bool                    leader_;
+        std::optional<TValue>   hit_;
+        std::shared_ptr<flight> flight_;
+    };
+
+    // loader(key) must return an awaitable whose result converts to TValue.
+    // It is only called, and only copied from, on a miss that no other load
+    // of key is already in flight for.
+    template<class F>
+    load_awaiter<F> co_get_or_load(TKey key, F loader) {
+        return load_awaiter<F>(*this, std::move(key), std::move(loader));
+    }
+
+    // The synchronous API, under the same lock.
+    bool get(const TKey& key, TValue& value) {
+        std::lock_guard<std::mutex> lock(lock_);
+        auto pos = cache_.get(key);
+        if (pos == cache_.end())
+            return false;
+        value = pos->second;
+        return true;
+    }
+
+    template<class V = TValue>
+    bool put(const TKey& key, V&& value) {
+        std::lock_guard<std::mutex> lock(lock_);
+        return cache_.put(key, std::forward<V>(value));
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(lock_);
+        cache_.clear();
+    }
+
+    size_type size() const {
+        std::lock_guard<std::mutex> lock(lock_);
+        return cache_.size();
+    }
+
+    // Misses waiting on a load count as misses.
+    LRUStatsSnapshot stats() const {
+        std::lock_guard<std::mutex> lock(lock_);
+        return cache_.stats();
+    }
+
+    // Keys with a load in flight.
+    size_type loading() const {
+        std::lock_guard<std::mutex> lock(lock_);
+        return flights_.size();
+    }
+
+private:
+    template<class F>
+    lru_detail::detached load(TKey key, F loader, std::shared_ptr<flight> f) {
+        std::optional<TValue> value;
+        std::exception_ptr error;
+        try{
+            value.emplace(co_await loader(static_cast<const TKey&>(key)));
+        }
+        catch (...){
+            error = std::current_exception();
+        }
+        land(key, f, value, error);
+    }
+
+    // Runs inside a detached coroutine, so nothing may escape it: a value
+    // the cache fails to take is handed to the waiters all the same, and
+    // one that fails to reach the flight becomes their exception.
+    void land(const TKey& key, const std::shared_ptr<flight>& f, std::optional<TValue>& value, std::exception_ptr error) {
+        std::vector<std::coroutine_handle<>> waiters;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            if (value){
+                try{
+                    cache_.put(key, *value);
+                }
+                catch (...){
+                    // not cached, that's all
+                }
+                try{
+                    f->value.emplace(std::move(*value));
+                }
+                catch (...){
+                    error = std::current_exception();
+                }
+            }
+            f->error = error;
+            f->done = true;
+            auto found = flights_.find(key);
+            if (found != flights_.end() && found->second == f)
+                flights_.erase(found);
+            waiters.swap(f->waiters);
+        }
+        for (std::size_t i = 0; i < waiters.size(); ++i)
+            waiters[i].resume();
+    }
+
+    mutable std::mutex lock_;
+    cache_type         cache_;
+    flight_map         flights_;
+};
+
+#endif // C++20 coroutines
+
+#endif // LRUASYNCCACHE_H
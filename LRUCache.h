@@ -9,76 +9,837 @@
 // http://www.boost.org/LICENSE_1_0.txt)
 // </copyright>
 //
+#ifndef LRUCACHE_H
+#define LRUCACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#if __cplusplus >= 201703L
+#include <string>
+#include <string_view>
+#endif
 #include <unordered_map>
+#include <vector>
 #include <list>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <utility>
 
-template<class TKey, class TValue, class TContainer = std::list< std::pair<TKey, TValue> > >
+#include "LRUFrequencySketch.h"
+#include "LRUPoolAllocator.h"
+#include "LRUSnapshot.h"
+#include "LRUStats.h"
+#include "LRUTimerWheel.h"
+
+namespace lru_detail {
+    // Detects a std::list-style splice(pos, other, it), which lets a node be
+    // relinked at the front of the container without copying or reallocating it.
+    template<class TContainer>
+    class has_splice {
+        template<class C>
+        static auto test(int) -> decltype(std::declval<C&>().splice(std::declval<typename C::iterator>(),
+                                                                    std::declval<C&>(),
+                                                                    std::declval<typename C::iterator>()),
+                                          std::true_type());
+        template<class C>
+        static std::false_type test(...);
+    public:
+        static const bool value = decltype(test<TContainer>(0))::value;
+    };
+
+    template<class>
+    struct void_type { typedef void type; };
+
+    // Hash and key-equal functors opt in to heterogeneous lookup by declaring
+    // an is_transparent member type, as for std::equal_to<> and C++20's
+    // unordered containers.
+    template<class T, class = void>
+    struct is_transparent : std::false_type {};
+
+    template<class T>
+    struct is_transparent<T, typename void_type<typename T::is_transparent>::type> : std::true_type {};
+
+    template<class THash, class TKeyEqual>
+    struct transparent_lookup
+        : std::integral_constant<bool, is_transparent<THash>::value && is_transparent<TKeyEqual>::value> {};
+
+    // Swaps the allocator of a Container<T, Allocator> (std::list, LRUSlab, ...)
+    // for TAllocator rebound to T. Containers of any other shape are kept as is.
+    template<class TContainer, class TAllocator>
+    struct rebind_container {
+        typedef TContainer type;
+    };
+
+    template<template<class, class> class TContainer, class T, class TOld, class TAllocator>
+    struct rebind_container<TContainer<T, TOld>, TAllocator> {
+        typedef TContainer<T, typename std::allocator_traits<TAllocator>::template rebind_alloc<T> > type;
+    };
+
+    // The cache recycles nodes through an LRUPoolAllocator unless the
+    // container was given an allocator of its own.
+    template<class TContainer>
+    struct default_allocator {
+        typedef typename TContainer::allocator_type type;
+    };
+
+    template<template<class, class> class TContainer, class T>
+    struct default_allocator< TContainer<T, std::allocator<T> > > {
+        typedef LRUPoolAllocator<T> type;
+    };
+
+    // Tells a pooling allocator how many nodes of each kind to expect.
+    template<class A>
+    inline auto reserve_allocator(const A& a, std::size_t n, int) -> decltype(a.reserve(n), void()) {
+        a.reserve(n);
+    }
+
+    template<class A>
+    inline void reserve_allocator(const A&, std::size_t, long) {}
+
+    template<class A>
+    inline void reserve_allocator(const A& a, std::size_t n) {
+        reserve_allocator(a, n, 0);
+    }
+
+    // Lets a pooling allocator give back what it no longer needs.
+    template<class A>
+    inline auto trim_allocator(const A& a, int) -> decltype(a.trim(), void()) {
+        a.trim();
+    }
+
+    template<class A>
+    inline void trim_allocator(const A&, long) {}
+
+    template<class A>
+    inline void trim_allocator(const A& a) {
+        trim_allocator(a, 0);
+    }
+
+    // What a pooling allocator holds, in nodes in use and nodes spare.
+    // False for allocators that can't tell.
+    template<class A>
+    inline auto pool_bytes(const A& a, std::size_t& used, std::size_t& spare, int)
+        -> decltype(a.used_bytes() + a.spare_bytes(), bool()) {
+        used = a.used_bytes();
+        spare = a.spare_bytes();
+        return true;
+    }
+
+    template<class A>
+    inline bool pool_bytes(const A&, std::size_t&, std::size_t&, long) { return false; }
+
+    template<class A>
+    inline bool pool_bytes(const A& a, std::size_t& used, std::size_t& spare) {
+        return pool_bytes(a, used, spare, 0);
+    }
+
+    // The part of an index's memory_bytes() that is its own nodes, as it
+    // estimates them (0 for indexes that allocate none).
+    template<class I>
+    inline auto index_node_bytes(const I& index, int) -> decltype(index.node_bytes()) {
+        return index.node_bytes();
+    }
+
+    template<class I>
+    inline std::size_t index_node_bytes(const I&, long) { return 0; }
+
+    template<class I>
+    inline std::size_t index_node_bytes(const I& index) {
+        return index_node_bytes(index, 0);
+    }
+
+    // Gives containers that preallocate (see LRUSlab.h) a chance to size
+    // themselves for the cache; a no-op for std::list and friends.
+    template<class C>
+    inline auto reserve_container(C& c, std::size_t n, int) -> decltype(c.reserve(n), void()) {
+        c.reserve(n);
+    }
+
+    template<class C>
+    inline void reserve_container(C&, std::size_t, long) {}
+
+    template<class C>
+    inline void reserve_container(C& c, std::size_t n) {
+        reserve_container(c, n, 0);
+    }
+
+    // A software prefetch hint; a no-op where the compiler has none.
+    inline void prefetch(const void* p) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(p);
+#else
+        (void)p;
+#endif
+    }
+
+    // Indexes that can't reuse a hash computed ahead of time take this.
+    struct no_prehash {};
+
+    // What an allocation of n bytes takes in practice: malloc() and
+    // LRUPoolAllocator both round up to alignof(std::max_align_t).
+    inline std::size_t allocation_bytes(std::size_t n) {
+        return (n + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    }
+
+    // Key extraction for the batch functions.
+    struct key_of_identity {
+        template<class K>
+        inline const K& operator()(const K& key) const { return key; }
+    };
+
+    struct key_of_pair {
+        template<class P>
+        inline auto operator()(const P& kv) const -> decltype((kv.first)) { return kv.first; }
+    };
+
+    // An atomic flag that is only ever accessed with relaxed ordering and that,
+    // unlike std::atomic, can be copied along with the entry it belongs to.
+    class relaxed_flag {
+    public:
+        relaxed_flag(bool value = false) : value_(value) {}
+        relaxed_flag(const relaxed_flag& other) : value_(other.load()) {}
+        relaxed_flag& operator=(const relaxed_flag& other) { store(other.load()); return *this; }
+
+        inline bool load() const        { return value_.load(std::memory_order_relaxed); }
+        inline void store(bool v) const { value_.store(v, std::memory_order_relaxed);    }
+
+    private:
+        mutable std::atomic<bool> value_;   // set by readers through const lookups
+    };
+
+    // Default lookup index: a std::unordered_map from a copy of each key to
+    // its container position. The container argument is unused, it is only
+    // there for indexes that read keys back out of the container.
+    template<class TKey, class TContainer, class TMapped, class THash, class TKeyEqual, class TAllocator>
+    class map_index {
+        typedef std::pair<const TKey, TMapped>                                              value_type;
+        typedef typename std::allocator_traits<TAllocator>::template rebind_alloc<value_type> allocator_type;
+        typedef std::unordered_map<TKey, TMapped, THash, TKeyEqual, allocator_type>         map_type;
+
+    public:
+        map_index(const THash& hash, const TKeyEqual& equal, const TAllocator& alloc)
+            : map_(0, hash, equal, allocator_type(alloc))
+        {}
+
+        template<class K>
+        inline TMapped* find(const TContainer&, const K& key) {
+            auto itrLookup = map_.find(lookup_key(key));
+            return (map_.end() == itrLookup) ? nullptr : &itrLookup->second;
+        }
+
+        template<class K>
+        inline const TMapped* find(const TContainer&, const K& key) const {
+            auto itrLookup = map_.find(lookup_key(key));
+            return (map_.end() == itrLookup) ? nullptr : &itrLookup->second;
+        }
+
+        inline TMapped& insert(const TContainer&, const TKey& key, const TMapped& mapped) {
+            return map_.insert(std::make_pair(key, mapped)).first->second;
+        }
+
+        // Batch lookups hash, prefetch and then find in separate passes. The
+        // map's buckets and nodes are out of reach, so there is nothing to
+        // hash or prefetch ahead of time here.
+        typedef no_prehash prehash_type;
+
+        template<class K>
+        static inline prehash_type prehash(const K&)                     { return prehash_type(); }
+        static inline void prefetch(prehash_type)                        {}
+        static inline void prefetch_entry(const TContainer&, prehash_type) {}
+
+        template<class K>
+        inline TMapped* find(const TContainer& c, const K& key, prehash_type) { return find(c, key); }
+
+        inline TMapped& insert(const TContainer& c, const TKey& key, const TMapped& mapped, prehash_type) {
+            return insert(c, key, mapped);
+        }
+
+        // Finds the entry of the node at pos; the map can only get there through its key.
+        template<class TIterator>
+        inline TMapped* find_at(const TContainer& c, TIterator pos) { return find(c, pos->first); }
+
+        inline void erase(const TContainer&, const TKey& key) { map_.erase(key); }
+        inline void clear()                                    { map_.clear();    }
+
+        // For memory_usage(). The map's internals are out of reach, so a
+        // node is taken to be a next pointer, the key/value pair and a cached
+        // hash, as libstdc++ and libc++ lay it out, and each bucket a pointer.
+        static const bool stores_keys = true;
+        inline std::size_t memory_bytes() const {
+            return map_.bucket_count() * sizeof(void*) + node_bytes();
+        }
+        inline std::size_t node_bytes() const {
+            return map_.size() * allocation_bytes(sizeof(void*) + sizeof(value_type) + sizeof(std::size_t));
+        }
+        inline std::size_t slots() const { return map_.bucket_count(); }
+
+        // Whether the index's memory stays put once reserved (see
+        // LRUCache::peek_racing()); nodes here come and go with the entries.
+        static const bool fixed_storage = false;
+        inline void reserve(std::size_t n)                     { map_.reserve(n); }
+        // Room for n keys without rehashing them all now; unordered_map
+        // can't, so it keeps growing as it fills.
+        inline void expand(std::size_t)                        {}
+
+    private:
+        static inline const TKey& lookup_key(const TKey& key) { return key; }
+
+#if defined(__cpp_lib_generic_unordered_lookup)
+        // C++20: the map looks up any type its transparent functors accept.
+        template<class K>
+        static inline const K& lookup_key(const K& key) { return key; }
+#else
+        // Before C++20 std::unordered_map::find() only takes key_type, so the
+        // key has to be built after all; other indexes (see LRUSlab.h) don't.
+        template<class K>
+        static inline TKey lookup_key(const K& key) { return TKey(key); }
+#endif
+
+        map_type map_;
+    };
+}
+
+// Describes how LRUCache refers to nodes of its container and which index it
+// uses to find them. The default suits node-based containers such as
+// std::list, whose iterators stay valid until the node is erased. Storage
+// engines can specialize this (see LRUSlab.h).
+template<class TContainer>
+struct LRUContainerTraits {
+    typedef typename TContainer::iterator       iterator;
+    typedef typename TContainer::const_iterator const_iterator;
+    typedef iterator                            handle_type;
+
+    template<class TKey, class TMapped, class THash, class TKeyEqual, class TAllocator>
+    struct index {
+        typedef lru_detail::map_index<TKey, TContainer, TMapped, THash, TKeyEqual, TAllocator> type;
+    };
+
+    static inline iterator       iterator_at(TContainer&, handle_type h)       { return h; }
+    static inline const_iterator iterator_at(const TContainer&, handle_type h) { return h; }
+    static inline handle_type    handle(TContainer&, iterator pos)             { return pos; }
+
+    // For memory_usage(): the bytes each node spends beyond its element,
+    // taken to be two links plus the allocator's rounding, and the room
+    // preallocated for elements not yet made (none).
+    static inline std::size_t link_bytes(const TContainer& c) {
+        typedef typename TContainer::value_type value_type;
+        return c.size() * (lru_detail::allocation_bytes(2 * sizeof(void*) + sizeof(value_type)) - sizeof(value_type));
+    }
+    static inline std::size_t reserved_bytes(const TContainer&) { return 0; }
+
+    // Calls f(element) for every element, in whatever order is quickest to
+    // read them: for a linked list, following the links.
+    template<class F>
+    static inline void visit(const TContainer& c, F&& f) {
+        for (typename TContainer::const_iterator pos = c.begin(); pos != c.end(); ++pos)
+            f(*pos);
+    }
+};
+
+// How the cache tracks recency.
+//  strict: exact LRU; every hit relinks the entry at the front.
+//  clock:  second chance, an approximation of LRU; a hit only sets the entry's
+//          reference bit (a relaxed atomic store), and eviction sends
+//          referenced entries at the tail round to the front again - clearing
+//          the bit - until it finds an unreferenced one. Hits therefore don't
+//          write to the list, but begin()..end() is insertion order with
+//          second chances rather than exact recency order.
+//  segmented: segmented LRU. New entries start on probation; a hit there
+//          moves the entry to the protected segment (the most recent 80%),
+//          whose least recent entries fall back to probation as it fills.
+//          Evicts from probation, so a scan of one-off keys only ever
+//          displaces other one-off keys.
+//  tinylfu: W-TinyLFU. New entries go into a small LRU window (1%) in front
+//          of a segmented main cache. An entry leaving the window only gets
+//          into the main cache if a frequency sketch (LRUFrequencySketch.h)
+//          rates its key more popular than the main cache's eviction victim;
+//          otherwise the entry itself is evicted.
+// The segmented policies need a container with splice() (std::list, LRUSlab).
+enum class LRUPolicy { strict, clock, segmented, tinylfu };
+
+// Why an entry was handed to the eviction listener: pushed out to make room
+// (including by resize() and trim()), dropped when its TTL ran out, or too
+// heavy for the weigher's budget to be kept at all.
+enum class LRUEvictionCause { capacity, expired, rejected };
+
+// When the eviction listener is called: from within the call that evicted
+// the entry, or later, by deliver_evictions(), from a buffer.
+enum class LRUEvictionMode { sync, batched };
+
+#if __cplusplus >= 201703L
+// A transparent hasher for std::string keys: together with std::equal_to<>
+// it lets get()/peek()/is_cached() take a std::string_view or a const char*
+// without building a std::string first.
+struct LRUStringHash {
+    typedef void is_transparent;
+
+    inline std::size_t operator()(std::string_view key) const { return std::hash<std::string_view>()(key); }
+};
+#endif
+
+// Constructor tag: size the lookup index for max_size() keys up front, so it
+// never rehashes while the cache warms up.
+struct LRUReserveIndex {};
+
+// Where a cache's memory goes, in bytes, as LRUCache::memory_usage() found
+// it. The slab and its indexes are counted exactly; std::list and
+// std::unordered_map nodes are estimated from their usual layout, since
+// their internals are out of reach - unless they come from an
+// LRUPoolAllocator, which knows its blocks exactly.
+struct LRUMemoryUsage {
+    LRUMemoryUsage()
+        : index_bytes(0), link_bytes(0), key_bytes(0), value_bytes(0), reserved_bytes(0), other_bytes(0)
+        , entries(0), index_slots(0)
+    {}
+
+    std::size_t index_bytes;        // lookup index: its table or buckets, nodes and copies of keys
+    std::size_t link_bytes;         // the container's recency links and per-node overhead
+    std::size_t key_bytes;          // keys in the container, and what they own if a sizer was given
+    std::size_t value_bytes;        // the same for values (and the pair's padding)
+    std::size_t reserved_bytes;     // room preallocated for entries not yet made, and a pool's spare nodes
+    std::size_t other_bytes;        // the cache object itself, TTL timers, frequency sketch, eviction buffer
+    std::size_t entries;
+    std::size_t index_slots;        // buckets or cells the index spreads the entries over
+
+    inline std::size_t total() const {
+        return index_bytes + link_bytes + key_bytes + value_bytes + reserved_bytes + other_bytes;
+    }
+
+    // Entries per index slot.
+    inline double load_factor() const { return index_slots ? double(entries) / index_slots : 0.0; }
+
+    LRUMemoryUsage& operator+=(const LRUMemoryUsage& other) {
+        index_bytes += other.index_bytes;
+        link_bytes += other.link_bytes;
+        key_bytes += other.key_bytes;
+        value_bytes += other.value_bytes;
+        reserved_bytes += other.reserved_bytes;
+        other_bytes += other.other_bytes;
+        entries += other.entries;
+        index_slots += other.index_slots;
+        return *this;
+    }
+};
+
+// A run of up to LRUEntryChunk::max_size entries handed out by
+// for_each_chunk(): chunk[i], or a range-for over chunk, for i below
+// chunk.size(). The entries belong to the cache (or to a snapshot of it),
+// so a chunk is only valid until the callback it was passed to returns.
+template<class T>
+class LRUEntryChunk {
+public:
+    static const std::size_t max_size = 64;
+
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T                         value_type;
+        typedef std::ptrdiff_t            difference_type;
+        typedef const T*                  pointer;
+        typedef const T&                  reference;
+
+        explicit const_iterator(const T* const* at = nullptr) : at_(at) {}
+
+        inline reference       operator*() const  { return **at_; }
+        inline pointer         operator->() const { return *at_;  }
+        inline const_iterator& operator++()       { ++at_; return *this; }
+        inline const_iterator  operator++(int)    { const_iterator old(*this); ++at_; return old; }
+
+        inline bool operator==(const const_iterator& other) const { return at_ == other.at_; }
+        inline bool operator!=(const const_iterator& other) const { return at_ != other.at_; }
+
+    private:
+        const T* const* at_;
+    };
+
+    LRUEntryChunk(const T* const* entries, std::size_t n) : entries_(entries), size_(n) {}
+
+    inline std::size_t    size() const                    { return size_;              }
+    inline bool           empty() const                   { return size_ == 0;         }
+    inline const T&       operator[](std::size_t i) const { return *entries_[i];       }
+    inline const_iterator begin() const                   { return const_iterator(entries_);         }
+    inline const_iterator end() const                     { return const_iterator(entries_ + size_); }
+
+private:
+    const T* const* entries_;
+    std::size_t     size_;
+};
+
+namespace lru_detail {
+    // Collects entries for for_each_chunk() and hands them to fn a full
+    // chunk at a time.
+    template<class T, class F>
+    class entry_chunker {
+    public:
+        explicit entry_chunker(F& fn) : fn_(fn), n_(0) {}
+
+        inline void add(const T& entry) {
+            entries_[n_++] = &entry;
+            if (n_ == LRUEntryChunk<T>::max_size)
+                flush();
+        }
+
+        void flush() {
+            if (!n_)
+                return;
+            LRUEntryChunk<T> chunk(entries_, n_);
+            n_ = 0;
+            fn_(static_cast<const LRUEntryChunk<T>&>(chunk));
+        }
+
+    private:
+        entry_chunker(const entry_chunker&);
+        entry_chunker& operator=(const entry_chunker&);
+
+        F&          fn_;
+        const T*    entries_[LRUEntryChunk<T>::max_size];
+        std::size_t n_;
+    };
+}
+
+// A sizer for memory_usage(): the heap bytes a std::basic_string or a
+// std::vector owns (nothing for a string short enough to be stored in the
+// object itself), what x.heap_bytes() says for a type that has it (e.g.
+// LRUCompactValue), and none for anything else. Nested containers are not
+// followed; write a sizer of your own for those.
+struct LRUHeapSizer {
+    template<class T>
+    inline std::size_t operator()(const T& x) const { return heap_bytes_of(x, 0); }
+
+    template<class TChar, class TTraits, class TAlloc>
+    inline std::size_t operator()(const std::basic_string<TChar, TTraits, TAlloc>& s) const {
+        const char* data = reinterpret_cast<const char*>(s.data());
+        const char* self = reinterpret_cast<const char*>(&s);
+        if (data >= self && data < self + sizeof(s))
+            return 0;
+        return lru_detail::allocation_bytes((s.capacity() + 1) * sizeof(TChar));
+    }
+
+    template<class T, class TAlloc>
+    inline std::size_t operator()(const std::vector<T, TAlloc>& v) const {
+        return v.capacity() ? lru_detail::allocation_bytes(v.capacity() * sizeof(T)) : 0;
+    }
+
+private:
+    template<class T>
+    static inline auto heap_bytes_of(const T& x, int) -> decltype(std::size_t(x.heap_bytes())) { return x.heap_bytes(); }
+
+    template<class T>
+    static inline std::size_t heap_bytes_of(const T&, long) { return 0; }
+};
+
+// A weigher that makes capacity a RAM budget: an entry weighs its key and
+// value plus what each owns on the heap, as LRUHeapSizer counts it. List
+// links and index slots are not included, so leave a little headroom.
+struct LRUMemoryWeigher {
+    template<class K, class V>
+    inline std::size_t operator()(const K& key, const V& value) const {
+        LRUHeapSizer sizer;
+        return sizeof(K) + sizeof(V) + sizer(key) + sizer(value);
+    }
+};
+
+// The default weigher: every entry weighs 1, so max_size() is an entry count.
+struct LRUUnitWeigher {
+    template<class K, class V>
+    inline std::size_t operator()(const K&, const V&) const { return 1; }
+};
+
+// THash and TKeyEqual hash and compare keys in the lookup index. If both are
+// transparent (declare is_transparent), get(), get_shared(), peek() and
+// is_cached() accept anything they can hash and compare against a TKey.
+//
+// TAllocator is used for both the container and the lookup index; a standard
+// shaped TContainer (std::list, LRUSlab) is rebound to it, so it only needs
+// spelling out once. It defaults to LRUPoolAllocator (see LRUPoolAllocator.h)
+// unless TContainer already names an allocator other than std::allocator:
+//
+//     LRUCache<K, V, std::list< std::pair<K, V> >, WyHash, std::equal_to<K>, PoolAllocator<int> >
+//
+// TWeigher turns capacity from an entry count into a total cost: it is called
+// as weigher(key, value) and returns the entry's weight (e.g. its size in
+// bytes), and the cache evicts from the tail until the weights of what it
+// holds add up to no more than max_size(). It must return the same weight for
+// an entry for as long as the entry is cached, since it is asked again at
+// eviction instead of the weight being stored.
+//
+// TStats decides what the cache counts and how (see LRUStats.h): LRUStats<>
+// by default, LRUNoStats to compile counting out, LRUStripedStats<> to count
+// from several threads, and either of the latter two with Timed = true to
+// keep get()/put() latency histograms as well.
+template<class TKey, class TValue, class TContainer = std::list< std::pair<TKey, TValue> >,
+         class THash = std::hash<TKey>, class TKeyEqual = std::equal_to<TKey>,
+         class TAllocator = typename lru_detail::default_allocator<TContainer>::type,
+         class TWeigher = LRUUnitWeigher, class TStats = LRUStats<> >
 class LRUCache {
+    template<class K>
+    struct if_transparent
+        : std::enable_if<lru_detail::transparent_lookup<THash, TKeyEqual>::value, int> {};
+
+    // With unit weights the cache makes room before inserting, so it never
+    // holds more than max_size() entries (and a preallocated container never
+    // grows); weighted entries can only be weighed once constructed.
+    static const bool weighted = !std::is_same<TWeigher, LRUUnitWeigher>::value;
+
 public:
-    typedef TContainer                                     container_type;
+    typedef typename lru_detail::rebind_container<TContainer, TAllocator>::type container_type;
     typedef typename container_type::iterator              iterator;
     typedef typename container_type::const_iterator        const_iterator;
     typedef typename container_type::const_reference       const_reference;
+    typedef typename container_type::value_type            value_type;
     typedef std::size_t                                    size_type;
+    typedef TKey                                           key_type;
+    typedef TValue                                         mapped_type;
+    typedef THash                                          hasher;
+    typedef TKeyEqual                                      key_equal;
+    typedef TAllocator                                     allocator_type;
+    typedef TWeigher                                       weigher_type;
+    typedef TStats                                         stats_type;
+    typedef std::chrono::steady_clock                      clock_type;
 
-    LRUCache(size_type size) 
-        : max_size_(size)
-        , cache_hits_(0)
-        , cache_misses_(0)
-        , update_count_(0)          
-        , bounce_count_(0)        
+    // Gets each evicted key and value by move.
+    typedef std::function<void(TKey&&, TValue&&, LRUEvictionCause)> eviction_listener;
+
+    struct eviction {
+        eviction(TKey&& k, TValue&& v, LRUEvictionCause c) : key(std::move(k)), value(std::move(v)), cause(c) {}
+
+        TKey             key;
+        TValue           value;
+        LRUEvictionCause cause;
+    };
+    typedef std::vector<eviction>                          eviction_batch;
+
+    typedef LRUSnapshotWriter<TKey, TValue>                snapshot_writer;
+    typedef LRUSnapshotReader<TKey, TValue>                snapshot_reader;
+
+    LRUCache(size_type size, LRUPolicy policy = LRUPolicy::strict,
+             const hasher& hash = hasher(), const key_equal& equal = key_equal(),
+             const allocator_type& alloc = allocator_type())
+        : LRUCache(size, weigher_type(), policy, hash, equal, alloc)
     {}
 
-    const_iterator get(TKey key){
-        auto itrLookup = lookupMap.find(key);
-        if (lookupMap.end() == itrLookup){
-            ++cache_misses_;
-            return end();
-        }
-        
-        ++cache_hits_;
-        auto containerPos = itrLookup->second;
-        if (containerPos != container.begin()){       
-            auto existing = *containerPos;          // save the existing key/value pair
-            
-            container.erase(containerPos);          // get rid of the old one from the existing position list
-            container.push_front(existing);         // and stick it at the front
-            lookupMap[key] = container.begin();     // fix the reference to it in the lookup map
+    // size is the total weight the cache may hold.
+    LRUCache(size_type size, const weigher_type& weigher, LRUPolicy policy = LRUPolicy::strict,
+             const hasher& hash = hasher(), const key_equal& equal = key_equal(),
+             const allocator_type& alloc = allocator_type())
+        : max_size_(size)
+        , policy_(policy)
+        , trim_step_(size_type(-1))
+        , weigher_(weigher)
+        , weight_(0)
+        , default_ttl_(clock_type::duration::zero())
+        , eviction_mode_(LRUEvictionMode::sync)
+        , hash_(hash)
+        , container(typename container_type::allocator_type(alloc))
+        , lookupMap(hash, equal, alloc)
+    {
+        if (segmented() && !lru_detail::has_splice<container_type>::value)
+            throw std::invalid_argument("LRUCache: segmented policies need a container with splice()");
+        if (!weighted){             // a weight budget says nothing about the entry count
+            lru_detail::reserve_allocator(alloc, size);
+            lru_detail::reserve_container(container, size);
         }
-        return container.begin();
+        reset_segments();
+        size_segments();
     }
-    
-    const_iterator peek(TKey key) const {
-        auto itrLookup = lookupMap.find(key);
-        if (lookupMap.end() == itrLookup){
-            return end();
-        }
-        else{
-            return itrLookup->second;
-        }
+
+    // Same as above, but also reserves the lookup index for size keys.
+    LRUCache(size_type size, LRUReserveIndex, LRUPolicy policy = LRUPolicy::strict,
+             const hasher& hash = hasher(), const key_equal& equal = key_equal(),
+             const allocator_type& alloc = allocator_type())
+        : LRUCache(size, policy, hash, equal, alloc)
+    {
+        lookupMap.reserve(size);
+    }
+
+    const_iterator get(const TKey& key){
+        return get_impl(key);
+    }
+
+    template<class K, typename if_transparent<K>::type = 0>
+    const_iterator get(const K& key){
+        return get_impl(key);
+    }
+
+    // Hit path for concurrent readers: safe to call from several threads at
+    // once (e.g. under a shared lock) as long as nothing modifies the cache
+    // meanwhile. Under LRUPolicy::clock this is a full hit, since it only sets
+    // the entry's reference bit; under the other policies it cannot promote
+    // and acts like peek(). Hits and misses are counted only if stats_type is
+    // safe to count from several threads (see LRUStats.h); otherwise the
+    // caller owns that.
+    //
+    // get() treats an expired entry (see set_default_ttl()) as a miss and
+    // drops it; get_shared(), peek() and is_cached() just report a miss.
+    const_iterator get_shared(const TKey& key) const {
+        return get_shared_impl(key);
+    }
+
+    template<class K, typename if_transparent<K>::type = 0>
+    const_iterator get_shared(const K& key) const {
+        return get_shared_impl(key);
+    }
+
+    const_iterator peek(const TKey& key) const {
+        return peek_impl(key);
+    }
+
+    template<class K, typename if_transparent<K>::type = 0>
+    const_iterator peek(const K& key) const {
+        return peek_impl(key);
+    }
+
+    // Applies a hit that was found and counted elsewhere, e.g. by
+    // get_shared() under a shared lock: does to key's entry what get() would
+    // (promotes it, or sets its reference bit, and counts the key in the
+    // TinyLFU sketch) without counting a hit. An expired entry is left for
+    // the timer wheel. Returns whether key was cached.
+    bool promote(const TKey& key){
+        record(key);
+        entry_type* entry = lookupMap.find(container, key);
+        if (!entry || expired(*entry))
+            return false;
+        touch(*entry);
+        return true;
+    }
+
+    // Inserts key/value, or replaces the value of an existing key in place.
+    // Returns true if the key was newly inserted, false if it replaced an existing value.
+    template<class V = TValue>
+    bool put(const TKey& key, V&& value){
+        return put_impl(key, std::forward<V>(value), lookupMap.prehash(key), default_ttl_);
+    }
+
+    template<class V = TValue>
+    bool put(TKey&& key, V&& value){
+        prehash_type hash = lookupMap.prehash(key);
+        return put_impl(std::move(key), std::forward<V>(value), hash, default_ttl_);
     }
 
-    void put(TKey key, TValue value){   // TODO: consider: return bool (new vs. replaced existing)?
-        auto itrLookup = lookupMap.find(key);
-        if (lookupMap.end() == itrLookup){ // it's not in there, need to add a new value
-            if (container.size() == max_size()){ 
-                // if already full, get rid of the oldest one:                
-                ++bounce_count_;
-                lookupMap.erase(container.back().first); // erase the oldest key from the lookup map
-                container.pop_back();                    // ...and the LRU container
-            }            
-            container.push_front(std::make_pair(key, value));
-            lookupMap.insert(std::make_pair(key, container.begin()));
+    // Same, but the entry expires ttl from now rather than after default_ttl().
+    // A zero ttl means it never expires.
+    template<class V = TValue, class Rep, class Period>
+    bool put(const TKey& key, V&& value, std::chrono::duration<Rep, Period> ttl){
+        return put_impl(key, std::forward<V>(value), lookupMap.prehash(key),
+                        std::chrono::duration_cast<clock_type::duration>(ttl));
+    }
+
+    template<class V = TValue, class Rep, class Period>
+    bool put(TKey&& key, V&& value, std::chrono::duration<Rep, Period> ttl){
+        prehash_type hash = lookupMap.prehash(key);
+        return put_impl(std::move(key), std::forward<V>(value), hash,
+                        std::chrono::duration_cast<clock_type::duration>(ttl));
+    }
+
+    // Like put(), but constructs the value from args: directly in the new node
+    // on insert, or into a temporary that is move-assigned on replace.
+    // Returns the entry's position and whether it was newly inserted.
+    //
+    // With a weigher, an entry heavier than max_size() on its own is not kept
+    // (and counts as bounced): put() still reports whether it was new, and
+    // emplace()/try_emplace() return end() for it.
+    template<class... Args>
+    std::pair<const_iterator, bool> emplace(const TKey& key, Args&&... args){
+        return emplace_impl(key, std::forward<Args>(args)...);
+    }
+
+    template<class... Args>
+    std::pair<const_iterator, bool> emplace(TKey&& key, Args&&... args){
+        return emplace_impl(std::move(key), std::forward<Args>(args)...);
+    }
+
+    // Constructs the value from args only if key is not cached yet. An existing
+    // value is left untouched (and args are not consumed), but still counts as
+    // a use of the entry, since the caller is about to use it.
+    template<class... Args>
+    std::pair<const_iterator, bool> try_emplace(const TKey& key, Args&&... args){
+        return try_emplace_impl(key, std::forward<Args>(args)...);
+    }
+
+    template<class... Args>
+    std::pair<const_iterator, bool> try_emplace(TKey&& key, Args&&... args){
+        return try_emplace_impl(std::move(key), std::forward<Args>(args)...);
+    }
+
+    // get() that fills a miss itself: if key is not cached, inserts
+    // loader(key) as its value, reusing the hash and the lookup the miss
+    // already paid for. Counts a hit or a miss like get(). loader must not
+    // use the cache; if it throws, nothing is inserted. Returns the entry's
+    // position, or end() if a weighted value was too heavy to keep.
+    template<class F>
+    const_iterator get_or_compute(const TKey& key, F&& loader){
+        return get_or_compute_impl(key, loader);
+    }
+
+    template<class F>
+    const_iterator get_or_compute(TKey&& key, F&& loader){
+        return get_or_compute_impl(std::move(key), loader);
+    }
+
+    // Batch get(): looks up every key in [first, last) and writes its position
+    // (end() on a miss) to out, as if get() had been called on each key in
+    // turn. Keys are processed in blocks: all of a block's hashes are computed
+    // and their index cells prefetched, then their entries, before any of
+    // them is resolved, so the cache misses of a block overlap instead of
+    // forming one dependent chain per key. Returns the hit mask.
+    template<class ForwardIt, class OutputIt>
+    std::vector<bool> multi_get(ForwardIt first, ForwardIt last, OutputIt out){
+        std::vector<bool> hits;
+        typename index_type::prehash_type hashes[batch_block];
+        while (first != last){
+            ForwardIt block = first;
+            std::size_t n = prefetch_block(first, last, hashes, lru_detail::key_of_identity());
+            entry_type* entries[batch_block];
+            for (std::size_t i = 0; i < n; ++i, ++block){
+                record(*block);
+                entries[i] = live(lookupMap.find(container, *block, hashes[i]));
+                if (entries[i] && LRUPolicy::strict == policy_)
+                    prefetch_neighbours(*entries[i]);   // promotion relinks them
+            }
+            for (std::size_t i = 0; i < n; ++i){
+                const_iterator pos = end();
+                if (entries[i]){
+                    stats_.count_hit();
+                    pos = touch(*entries[i]);
+                }
+                else{
+                    stats_.count_miss();
+                }
+                hits.push_back(pos != end());
+                *out++ = pos;
+            }
         }
-        else{
-            // it exists, replace existing value
-            ++update_count_;
-            container.erase(itrLookup->second);
-            container.push_front(std::make_pair(key, value));
-            lookupMap[key] = container.begin();
+        return hits;
+    }
+
+    // Batch put() of a range of key/value pairs (moved from if the range
+    // yields rvalues, e.g. through std::make_move_iterator), prefetching in
+    // blocks like multi_get(). Returns a mask that is true where the key was
+    // newly inserted.
+    template<class ForwardIt>
+    std::vector<bool> multi_put(ForwardIt first, ForwardIt last){
+        std::vector<bool> inserted;
+        typename index_type::prehash_type hashes[batch_block];
+        while (first != last){
+            ForwardIt block = first;
+            std::size_t n = prefetch_block(first, last, hashes, lru_detail::key_of_pair());
+            for (std::size_t i = 0; i < n; ++i, ++block){
+                auto&& kv = *block;
+                inserted.push_back(put_impl(std::forward<decltype(kv)>(kv).first,
+                                            std::forward<decltype(kv)>(kv).second, hashes[i], default_ttl_));
+            }
         }
+        return inserted;
     }
 
     inline const_iterator  begin() const { return container.begin(); }
@@ -89,32 +850,999 @@ public:
     inline bool empty() const            { return container.empty(); }
     inline size_type size() const        { return container.size();  }
     inline size_type max_size() const    { return max_size_;         }
+    inline LRUPolicy policy() const      { return policy_;           }
+
+    // Total weight of the cached entries (size() with unit weights) and the
+    // most it may reach.
+    inline size_type weight() const      { return weighted ? weight_ : size(); }
+    inline size_type max_weight() const  { return max_size_;         }
+
+    inline weigher_type weigher() const  { return weigher_;          }
+
+    inline allocator_type get_allocator() const { return allocator_type(container.get_allocator()); }
     
+    // Gives the nodes back to a pooling allocator, too.
     inline void clear() {
         container.clear();
         lookupMap.clear();
+        weight_ = 0;
+        reset_segments();
+        sketch_.clear();
+        timers_.clear();
+        lru_detail::trim_allocator(container.get_allocator());
     }
     
-    inline bool is_cached(TKey key) const {
+    // Whether peek_racing() may be used: a container and index whose memory
+    // stays put once reserved (LRUSlab with LRUSlabIndex), unit weights -
+    // so the container never outgrows what the constructor reserved - and
+    // trivially copyable keys and values.
+    static constexpr bool racing_peeks() {
+        return !weighted && index_type::fixed_storage && std::is_trivially_copyable<TKey>::value &&
+               std::is_trivially_copyable<TValue>::value;
+    }
+
+    // For optimistic readers such as ShardedLRUCache::peek(): looks key up
+    // like peek() while a writer may be changing the cache, and copies the
+    // value it finds to the sizeof(TValue) bytes at value. What it reads may
+    // be torn, so the caller must validate the result against the writers'
+    // version counter (a seqlock) and discard it if a write overlapped, and
+    // must keep the cache from growing meanwhile - and from ever having
+    // grown since the index was reserved (the LRUReserveIndex constructor).
+    // Only if racing_peeks(). Returns 1 on a hit, 0 on a miss, and -1 for an
+    // entry with a TTL, which can't be checked without the lock.
+    template<class K>
+    int peek_racing(const K& key, void* value) const {
+        static_assert(racing_peeks(), "peek_racing() needs LRUSlab, LRUSlabIndex, unit weights and trivially copyable keys and values");
+        const entry_type* entry = lookupMap.find(container, key);
+        if (!entry)
+            return 0;
+        if (entry->timer)
+            return -1;
+        std::memcpy(value, &traits_type::iterator_at(container, entry->pos)->second, sizeof(TValue));
+        return 1;
+    }
+
+    inline bool is_cached(const TKey& key) const {
         // this is faster than (peek(k) != end()), but probably just as useless.
-        return (lookupMap.find(key) != lookupMap.end());
+        const entry_type* entry = lookupMap.find(container, key);
+        return entry && !expired(*entry);
     }
 
-    inline unsigned long long cache_hits()   const { return cache_hits_;    }
-    inline unsigned long long cache_misses() const { return cache_misses_;  }
-    inline unsigned long long update_count() const { return update_count_;  }
-    inline unsigned long long bounce_count() const { return bounce_count_;  }
+    template<class K, typename if_transparent<K>::type = 0>
+    inline bool is_cached(const K& key) const {
+        const entry_type* entry = lookupMap.find(container, key);
+        return entry && !expired(*entry);
+    }
+
+    // Entries written without a TTL of their own (put() without one,
+    // emplace(), try_emplace() inserting) expire this long after they were
+    // written. Zero, the default, means never. Only affects later writes.
+    template<class Rep, class Period>
+    void set_default_ttl(std::chrono::duration<Rep, Period> ttl){
+        default_ttl_ = std::chrono::duration_cast<clock_type::duration>(ttl);
+    }
+
+    inline clock_type::duration default_ttl() const { return default_ttl_; }
+
+    // Gives a cached entry a new TTL counted from now (zero: never expires).
+    // Returns false if key is not cached.
+    template<class Rep, class Period>
+    bool expire_after(const TKey& key, std::chrono::duration<Rep, Period> ttl){
+        reap();
+        entry_type* entry = live(lookupMap.find(container, key));
+        if (!entry)
+            return false;
+        set_expiry(*entry, std::chrono::duration_cast<clock_type::duration>(ttl));
+        return true;
+    }
+
+    // Expired entries stop being served at once, but only give up their room
+    // when the timer wheel reaches them, which inserts take care of as they
+    // go. This does it now, e.g. for a cache that has gone quiet. Returns how
+    // many entries it dropped.
+    size_type expire(){
+        return reap();
+    }
+
+    // Calls listener with every entry the cache evicts from now on (see
+    // LRUEvictionCause; clear() and replaced values are not evictions).
+    //
+    // In sync mode it is called in the middle of the put() (or get(), for
+    // an expired entry) that evicted it, so it must not touch the cache, and
+    // anything slow it does happens under whatever lock guards the cache.
+    // In batched mode evictions are moved into a buffer instead, for
+    // deliver_evictions() to hand over after the lock is released; the
+    // buffer grows until then. Either way the listener must not throw.
+    // Pending evictions are delivered to the old listener first; an empty
+    // listener turns notification off.
+    void set_eviction_listener(eviction_listener listener, LRUEvictionMode mode = LRUEvictionMode::sync){
+        deliver_evictions();
+        listener_ = std::move(listener);
+        eviction_mode_ = mode;
+    }
+
+    // Batched mode: calls the listener on each buffered eviction, oldest
+    // first, and returns how many there were. The listener may use the
+    // cache now; anything it evicts waits for the next delivery.
+    size_type deliver_evictions(){
+        if (evicted_.empty())
+            return 0;
+        eviction_batch batch;
+        batch.swap(evicted_);
+        for (std::size_t i = 0; i < batch.size(); ++i)
+            listener_(std::move(batch[i].key), std::move(batch[i].value), batch[i].cause);
+        size_type n = batch.size();
+        if (evicted_.empty()){
+            batch.clear();
+            evicted_.swap(batch);               // keep the buffer's storage
+        }
+        return n;
+    }
+
+    // Batched mode: swaps the buffered evictions into batch (passed in empty)
+    // for the caller to deliver some other way, e.g. once several caches'
+    // worth are collected. batch's storage becomes the next buffer.
+    inline void take_evictions(eviction_batch& batch){
+        if (!evicted_.empty())
+            evicted_.swap(batch);
+    }
+
+    inline size_type pending_evictions() const { return evicted_.size(); }
+
+    // All zero under LRUNoStats.
+    inline unsigned long long cache_hits()   const { return stats_.snapshot().hits;    }
+    inline unsigned long long cache_misses() const { return stats_.snapshot().misses;  }
+    inline unsigned long long update_count() const { return stats_.snapshot().updates; }
+    inline unsigned long long bounce_count() const { return stats_.snapshot().bounces; }
+    inline unsigned long long expired_count() const { return stats_.snapshot().expired; }
+
+    // Everything counted so far, latency histograms included.
+    inline LRUStatsSnapshot stats() const { return stats_.snapshot(); }
+
+    // Where the cache's memory goes (see LRUMemoryUsage), without visiting
+    // the entries: keys and values count their sizeof() only.
+    LRUMemoryUsage memory_usage() const {
+        LRUMemoryUsage m;
+        m.entries = container.size();
+        m.index_bytes = lookupMap.memory_bytes();
+        m.index_slots = lookupMap.slots();
+        m.link_bytes = traits_type::link_bytes(container);
+        m.key_bytes = m.entries * sizeof(TKey);
+        m.value_bytes = m.entries * (sizeof(typename container_type::value_type) - sizeof(TKey));
+        m.reserved_bytes = traits_type::reserved_bytes(container);
+        m.other_bytes = sizeof(*this) + timers_.heap_bytes() + sketch_.capacity() * sizeof(std::uint64_t) +
+                        evicted_.capacity() * sizeof(eviction);
+        // A pool holds the container's and the index's nodes and nothing
+        // else. The container's are laid out as estimated (two links and
+        // the element, rounded as the pool rounds), so the index's are
+        // whatever else is in use; the free ones are held for later entries.
+        std::size_t used, spare;
+        if (lru_detail::pool_bytes(container.get_allocator(), used, spare)){
+            std::size_t nodes = m.link_bytes + m.entries * sizeof(typename container_type::value_type);
+            if (used >= nodes)
+                m.index_bytes = m.index_bytes - lru_detail::index_node_bytes(lookupMap) + (used - nodes);
+            m.reserved_bytes += spare;
+        }
+        return m;
+    }
+
+    // Same, adding what each key and value owns on the heap as sizer(key)
+    // and sizer(value) tell it, e.g. LRUHeapSizer. Visits every entry; keys
+    // the index keeps copies of count twice, once in index_bytes.
+    template<class F>
+    LRUMemoryUsage memory_usage(F sizer) const {
+        LRUMemoryUsage m = memory_usage();
+        for (const_iterator pos = container.begin(); pos != container.end(); ++pos){
+            std::size_t k = sizer(pos->first);
+            m.key_bytes += k;
+            if (index_type::stores_keys)
+                m.index_bytes += k;
+            m.value_bytes += sizer(pos->second);
+        }
+        return m;
+    }
+
+    // Read-only bulk export: calls fn(chunk) with every cached entry, as
+    // LRUEntryChunk<value_type>s of up to LRUEntryChunk::max_size entries,
+    // without promoting anything or counting hits. A slab is read in slot
+    // order, straight through its array, rather than recency order; other
+    // containers are walked front to back. Expired entries are left out.
+    // fn must not modify the cache.
+    template<class F>
+    void for_each_chunk(F fn) const {
+        lru_detail::entry_chunker<value_type, F> chunks(fn);
+        traits_type::visit(container, [this, &chunks](const value_type& entry) {
+            if (timers_.empty() || !expired(*lookupMap.find(container, entry.first)))
+                chunks.add(entry);
+        });
+        chunks.flush();
+    }
+
+    // Copies every entry for_each_chunk() would visit to out, in the same
+    // order, and returns how many there were.
+    template<class OutputIt>
+    size_type copy_to(OutputIt out) const {
+        size_type n = 0;
+        for_each_chunk([&out, &n](const LRUEntryChunk<value_type>& chunk) {
+            out = std::copy(chunk.begin(), chunk.end(), out);
+            n += chunk.size();
+        });
+        return n;
+    }
+
+    // Returns what has been counted so far and starts counting from zero.
+    inline LRUStatsSnapshot reset_stats() { return stats_.reset(); }
+
+    // Writes the cached entries to path, most recently used first, in the
+    // format described in LRUSnapshot.h. Expired entries are left out, and
+    // TTLs are not saved. Throws std::runtime_error if path can't be written.
+    void save(const std::string& path) const {
+        snapshot_writer writer(path);
+        save(writer);
+        writer.commit();
+    }
+
+    // Same, into a writer the caller commits (e.g. once several caches have
+    // written to it).
+    void save(snapshot_writer& writer) const {
+        for (const_iterator pos = begin(); pos != end(); ++pos){
+            if (!timers_.empty() && expired(*lookupMap.find(container, pos->first)))
+                continue;
+            writer.write(pos->first, pos->second);
+        }
+    }
+
+    // Warm start: adds the entries of a snapshot written by save(), as many
+    // as fit without evicting anything, and returns how many were added. See
+    // load_some().
+    size_type load(const std::string& path) {
+        snapshot_reader reader(path);
+        return load_some(reader);
+    }
+
+    // Adds up to max_entries more entries from reader, for warming up a
+    // cache that is already serving: call it between requests (under the
+    // cache's lock, if it has one) until reader.done(). Entries go in at the
+    // least recent end, most recent first - so what is hottest is loaded
+    // first, and anything put() meanwhile stays more recent - with the
+    // default TTL. Keys already cached are skipped, and once the cache is full
+    // the rest of the snapshot is. Returns how many entries were added.
+    size_type load_some(snapshot_reader& reader, size_type max_entries = size_type(-1)) {
+        reap();
+        if (!weighted && container.empty())
+            lookupMap.reserve(static_cast<size_type>(std::min<std::uint64_t>(reader.remaining(), max_size_)));
+        size_type n = 0;
+        TKey key;
+        TValue value;
+        while (n < max_entries && reader.next(key, value)){
+            switch (restore_entry(std::move(key), std::move(value))){
+            case restored: ++n; break;
+            case no_room:  reader.stop(); break;
+            default:       break;
+            }
+        }
+        return n;
+    }
+
+    // Adds key/value as the least recently used entry, if key is not cached
+    // and there is room for it without evicting anything: what load_some()
+    // does with each entry, for callers feeding a cache from elsewhere, most
+    // recent first. Returns whether it was added.
+    bool restore(TKey key, TValue value) {
+        reap();
+        return restored == restore_entry(std::move(key), std::move(value));
+    }
+
+    // Bulk warm load: replaces the cache's contents with the key/value pairs
+    // of [first, last), given most recently used first (and moved from if
+    // the range yields rvalues, e.g. through std::make_move_iterator), as
+    // many as fit. Instead of a put() per entry, the container and the index
+    // are reserved once for the whole range, keys are hashed a window at a
+    // time ahead of their inserts so that those can prefetch, and nothing is
+    // ever evicted: entries are appended at the least recent end, like
+    // load_some() does, a key already loaded keeps its first (most recent)
+    // value, and loading stops once the cache is full. With threads > 1 each
+    // window of keys is hashed on that many threads, for indexes that take a
+    // precomputed hash (LRUSlabIndex, LRUSwissIndex); the hasher must then be
+    // safe to call concurrently. Returns how many entries were loaded.
+    template<class ForwardIt>
+    size_type assign(ForwardIt first, ForwardIt last, unsigned threads = 1) {
+        clear();
+        std::size_t count = static_cast<std::size_t>(std::distance(first, last));
+        if (!weighted){
+            lru_detail::reserve_container(container, std::min(count, max_size_));
+            lookupMap.reserve(std::min(count, max_size_));
+        }
+        std::vector<prehash_type> hashes(std::min(count, std::size_t(assign_window)));
+        size_type n = 0;
+        for (std::size_t done = 0; done < count; ){
+            std::size_t window = std::min(count - done, std::size_t(assign_window));
+            prehash_range(first, window, hashes.data(), threads);
+            for (std::size_t i = 0; i < window; ++i, ++first){
+                if (i + batch_block < window)
+                    lookupMap.prefetch(hashes[i + batch_block]);
+                if (i + batch_block / 2 < window)
+                    lookupMap.prefetch_entry(container, hashes[i + batch_block / 2]);
+                auto&& kv = *first;
+                switch (restore_entry(std::forward<decltype(kv)>(kv).first,
+                                      std::forward<decltype(kv)>(kv).second, hashes[i])){
+                case restored: ++n; break;
+                case no_room:  return n;
+                default:       break;
+                }
+            }
+            done += window;
+        }
+        return n;
+    }
+
+    // Changes max_size(). Growing reserves room in containers that
+    // preallocate; the slab index allocates its larger table but moves its
+    // cells across a few per insert rather than all at once
+    // (std::unordered_map still rehashes as it fills, as it always has).
+    // Shrinking evicts from back(): at most max_evictions entries right away,
+    // and at most max_evictions more on each later insert, until size() is
+    // back within new_size. The default evicts everything at once; 0 defers
+    // all of it, one extra eviction per insert. new_size must be at least 1.
+    // A pooling allocator then gives back the chunks the evictions emptied
+    // (what deferred evictions free later stays there until clear()).
+    void resize(size_type new_size, size_type max_evictions = size_type(-1)){
+        assert(new_size > 0);
+        if (new_size > max_size_ && !weighted){
+            lru_detail::reserve_container(container, new_size);
+            lookupMap.expand(new_size);
+        }
+        bool shrinking = new_size < max_size_;
+        max_size_ = new_size;
+        trim_step_ = max_evictions ? max_evictions : 1;
+        size_segments();
+        if (trim(max_evictions) && shrinking)
+            lru_detail::trim_allocator(container.get_allocator());
+    }
+
+    // Evicts up to max_evictions entries beyond max_size() (left over from a
+    // lazy resize()), for callers that would rather do it off the insert
+    // path. Returns how many were evicted.
+    size_type trim(size_type max_evictions = size_type(-1)){
+        size_type n = 0;
+        for (; n < max_evictions && over_budget(); ++n)
+            evict_one();
+        return n;
+    }
 
-    // TODO: Consider adding the following members to the public interface:
-    //      resize           ???
-    
 private:    
+    typedef LRUContainerTraits<container_type>             traits_type;
+    typedef typename traits_type::handle_type              handle_type;
+
+    enum { in_window, in_probation, in_protected };
+
+    // What the lookup index maps each key to.
+    struct entry_type {
+        explicit entry_type(handle_type p) : pos(p), timer(0), segment(in_window) {}
+        handle_type              pos;
+        std::uint32_t            timer;         // in timers_, 0 if it never expires
+        lru_detail::relaxed_flag referenced;    // LRUPolicy::clock only
+        unsigned char            segment;       // LRUPolicy::segmented and tinylfu only
+    };
+
+    // LRUPolicy::segmented and tinylfu keep their segments in the one
+    // container: front to back, the window (tinylfu only), the protected
+    // segment and probation. The boundaries are handles rather than
+    // iterators so that they survive copying a slab along with the index.
+    struct segment_state {
+        handle_type window_end;         // first entry past the window
+        handle_type probation;          // first probation entry
+        size_type   window_weight;
+        size_type   protected_weight;
+        size_type   window_cap;
+        size_type   protected_cap;
+    };
+
+    typedef typename traits_type::template index<TKey, entry_type, THash, TKeyEqual, TAllocator>::type index_type;
+    typedef typename index_type::prehash_type                 prehash_type;
+
+    // Keys per multi_get()/multi_put() block: enough to overlap the misses,
+    // few enough that the first prefetches are still in cache when used.
+    static const std::size_t batch_block = 16;
+
+    // Hashes up to batch_block keys from first and prefetches their index
+    // cells, then their entries. Advances first past the block.
+    template<class ForwardIt, class KeyOf>
+    std::size_t prefetch_block(ForwardIt& first, ForwardIt last, prehash_type* hashes, KeyOf key_of){
+        std::size_t n = 0;
+        for (; n < batch_block && first != last; ++n, ++first){
+            hashes[n] = lookupMap.prehash(key_of(*first));
+            lookupMap.prefetch(hashes[n]);
+        }
+        for (std::size_t i = 0; i < n; ++i){
+            lookupMap.prefetch_entry(container, hashes[i]);
+        }
+        return n;
+    }
+
+    inline void prefetch_neighbours(const entry_type& entry){
+        iterator pos = position(entry);
+        if (pos == container.begin())
+            return;
+        lru_detail::prefetch(&*std::prev(pos));
+        if (++pos != container.end())
+            lru_detail::prefetch(&*pos);
+    }
+
+    template<class K>
+    const_iterator get_impl(const K& key){
+        return get_impl(key, lookupMap.prehash(key));
+    }
+
+    template<class K>
+    const_iterator get_impl(const K& key, prehash_type hash){
+        lru_detail::stopwatch<stats_type::timed> watch;
+        record(key);
+        entry_type* entry = live(lookupMap.find(container, key, hash));
+        const_iterator pos = end();
+        if (entry){
+            stats_.count_hit();
+            pos = touch(*entry);
+        }
+        else{
+            stats_.count_miss();
+        }
+        stats_.time_get(watch.elapsed());
+        return pos;
+    }
+
+    // Keys hashed at a time by assign(), and the fewest worth splitting
+    // over several threads.
+    static const std::size_t assign_window = std::size_t(1) << 16;
+    static const std::size_t parallel_hash_min = std::size_t(1) << 12;
+
+    // Writes the prehash of each of the n keys from first to hashes, on up
+    // to threads threads if the index has any use for them.
+    template<class ForwardIt>
+    void prehash_range(ForwardIt first, std::size_t n, prehash_type* hashes, unsigned threads) const {
+        lru_detail::key_of_pair key_of;
+        std::size_t per_thread = threads > 1 ? (n + threads - 1) / threads : n;
+        if (std::is_empty<prehash_type>::value || per_thread < parallel_hash_min)
+            per_thread = n;
+        std::vector<std::thread> helpers;
+        try{
+            ForwardIt from = first;
+            for (std::size_t at = per_thread; at < n; at += per_thread){
+                std::advance(from, per_thread);
+                std::size_t end = std::min(n, at + per_thread);
+                helpers.emplace_back([this, from, at, end, hashes, key_of]() {
+                    ForwardIt it = from;
+                    for (std::size_t i = at; i < end; ++i, ++it)
+                        hashes[i] = lookupMap.prehash(key_of(*it));
+                });
+            }
+        }
+        catch (...){                // couldn't start them all: join what did start
+            for (std::size_t t = 0; t < helpers.size(); ++t)
+                helpers[t].join();
+            throw;
+        }
+        for (std::size_t i = 0; i < per_thread && i < n; ++i, ++first)
+            hashes[i] = lookupMap.prehash(key_of(*first));
+        for (std::size_t t = 0; t < helpers.size(); ++t)
+            helpers[t].join();
+    }
+
+    enum restore_result { restored, already_cached, no_room };
+
+    restore_result restore_entry(TKey&& key, TValue&& value) {
+        prehash_type hash = lookupMap.prehash(key);
+        return restore_entry(std::move(key), std::move(value), hash);
+    }
+
+    template<class K, class V>
+    restore_result restore_entry(K&& key, V&& value, prehash_type hash) {
+        size_type w = weighted ? weigher_(key, value) : 1;
+        if (weighted ? w > max_size_ - std::min(weight_, max_size_) : container.size() >= max_size_)
+            return no_room;
+        if (lookupMap.find(container, key, hash))
+            return already_cached;
+        container.emplace_back(std::forward<K>(key), std::forward<V>(value));
+        iterator back = std::prev(container.end());
+        entry_type& fresh = lookupMap.insert(container, back->first, entry_type(handle(back)), hash);
+        if (segmented()){
+            // the tail of probation; a segment that ended at end() now ends here
+            handle_type h = handle(back), tail = handle(container.end());
+            fresh.segment = in_probation;
+            if (segments_.window_end == tail)
+                segments_.window_end = h;
+            if (segments_.probation == tail)
+                segments_.probation = h;
+            if (LRUPolicy::tinylfu == policy_ && sketch_.capacity() < container.size())
+                sketch_.reserve(container.size());
+        }
+        weight_ += weighted ? w : 0;
+        set_expiry(fresh, default_ttl_);
+        return restored;
+    }
+
+    template<class K, class F>
+    const_iterator get_or_compute_impl(K&& key, F& loader){
+        prehash_type hash = lookupMap.prehash(key);
+        reap();
+        record(key);
+        entry_type* entry = live(lookupMap.find(container, key, hash));
+        if (entry){
+            stats_.count_hit();
+            return touch(*entry);
+        }
+        stats_.count_miss();
+        // loader runs (and may throw) before anything is evicted for its value
+        return emplace_new(hash, std::forward<K>(key), loader(static_cast<const TKey&>(key)));
+    }
+
+    template<class K>
+    const_iterator get_shared_impl(const K& key) const {
+        static const bool counted = stats_type::concurrent;
+        lru_detail::stopwatch<counted && stats_type::timed> watch;
+        const entry_type* entry = lookupMap.find(container, key);
+        const_iterator pos = end();
+        if (entry && !expired(*entry)){
+            if (LRUPolicy::clock == policy_){
+                entry->referenced.store(true);
+            }
+            pos = traits_type::iterator_at(container, entry->pos);
+        }
+        if (counted){
+            if (pos != end())
+                stats_.count_hit();
+            else
+                stats_.count_miss();
+            stats_.time_get(watch.elapsed());
+        }
+        return pos;
+    }
+
+    template<class K>
+    const_iterator peek_impl(const K& key) const {
+        const entry_type* entry = lookupMap.find(container, key);
+        if (!entry || expired(*entry)){
+            return end();
+        }
+        else{
+            return traits_type::iterator_at(container, entry->pos);
+        }
+    }
+
+    inline iterator position(const entry_type& entry) {
+        return traits_type::iterator_at(container, entry.pos);
+    }
+
+    // Records a use of the entry according to the policy and returns its position.
+    inline const_iterator touch(entry_type& entry) {
+        if (LRUPolicy::clock == policy_){
+            entry.referenced.store(true);
+            return position(entry);
+        }
+        if (segmented()){
+            promote(entry);
+            return position(entry);
+        }
+        move_to_front(entry);                   // fixes up the lookup map entry in place
+        return container.begin();
+    }
+
+    inline bool segmented() const {
+        return LRUPolicy::segmented == policy_ || LRUPolicy::tinylfu == policy_;
+    }
+
+    // Counts an access to key in the TinyLFU sketch.
+    template<class K>
+    inline void record(const K& key) {
+        if (LRUPolicy::tinylfu == policy_)
+            sketch_.increment(hash_(key));
+    }
+
+    inline handle_type handle(iterator pos) { return traits_type::handle(container, pos); }
+    inline iterator    at(handle_type h)    { return traits_type::iterator_at(container, h); }
+
+    inline void reset_segments() {
+        segments_.window_end = segments_.probation = handle(container.end());
+        segments_.window_weight = segments_.protected_weight = 0;
+    }
+
+    inline void size_segments() {
+        size_type window = LRUPolicy::tinylfu == policy_ ? std::max<size_type>(1, max_size_ / 100) : 0;
+        size_type main = max_size_ - window;
+        segments_.window_cap = window;
+        segments_.protected_cap = main - main / 5;
+    }
+
+    // A hit under the segmented policies: window entries move to the front
+    // of the window, and probation and protected entries to the front of the
+    // protected segment. An overfull protected segment then hands its least
+    // recent entries back to probation, which only moves the boundary.
+    void promote(entry_type& entry) {
+        iterator pos = position(entry);
+        if (in_window == entry.segment){
+            if (pos != container.begin())
+                relink(container.begin(), pos);
+            return;
+        }
+        iterator head = at(segments_.window_end);
+        if (in_probation == entry.segment){
+            if (handle(pos) == segments_.probation)
+                segments_.probation = handle(std::next(pos));
+            entry.segment = in_protected;
+            segments_.protected_weight += weigh(*pos);
+        }
+        if (pos != head)
+            relink(head, pos);
+        segments_.window_end = handle(pos);
+        while (segments_.protected_weight > segments_.protected_cap){
+            iterator tail = std::prev(at(segments_.probation));
+            lookupMap.find_at(container, handle(tail))->segment = in_probation;
+            segments_.protected_weight -= weigh(*tail);
+            segments_.probation = handle(tail);
+        }
+    }
+
+    // Files a freshly inserted entry (at the front) into the window, pushing
+    // the window's least recent entries out onto probation as it overflows.
+    // Whether they may stay there was settled by victim() beforehand.
+    void admit(size_type weight) {
+        if (!segmented())
+            return;
+        if (LRUPolicy::tinylfu == policy_ && sketch_.capacity() < container.size())
+            sketch_.reserve(container.size());  // grows with the entry count
+        segments_.window_weight += weight;
+        while (segments_.window_weight > segments_.window_cap){
+            iterator tail = std::prev(at(segments_.window_end));
+            lookupMap.find_at(container, handle(tail))->segment = in_probation;
+            segments_.window_weight -= weigh(*tail);
+            if (segments_.window_end == segments_.probation){
+                segments_.window_end = segments_.probation = handle(tail);
+            }
+            else{
+                relink(at(segments_.probation), tail);
+                segments_.probation = handle(tail);
+            }
+        }
+    }
+
+    // Keeps the segment totals right when an entry's value, and so its
+    // weight, is replaced.
+    inline void reweigh(entry_type& entry, size_type added) {
+        if (!segmented())
+            return;
+        if (in_window == entry.segment)
+            segments_.window_weight += added;
+        else if (in_protected == entry.segment)
+            segments_.protected_weight += added;
+    }
+
+    // The clock hand: referenced entries at the tail get their bit cleared and
+    // go round to the front once more. Stops at the first unreferenced entry,
+    // and after one full sweep at the latest.
+    inline void second_chance() {
+        for (size_type n = container.size(); n > 0; --n){
+            entry_type* entry = lookupMap.find_at(container, traits_type::handle(container, std::prev(container.end())));
+            if (!entry->referenced.load())
+                break;
+            entry->referenced.store(false);
+            move_to_front(*entry);
+        }
+    }
+
+    // Relinks the entry's node to the front of the container and leaves the
+    // entry referring to it there.
+    inline void move_to_front(entry_type& entry) {
+        iterator pos = position(entry);
+        if (pos == container.begin())
+            return;
+        move_to_front(entry, pos, std::integral_constant<bool, lru_detail::has_splice<container_type>::value>());
+    }
+
+    inline void move_to_front(entry_type&, iterator pos, std::true_type) {
+        container.splice(container.begin(), container, pos);    // no copy, no allocation; pos stays valid
+    }
+
+    inline void move_to_front(entry_type& entry, iterator pos, std::false_type) {
+        auto existing = *pos;               // save the existing key/value pair
+        container.erase(pos);               // get rid of the old one from the existing position list
+        container.push_front(existing);     // and stick it at the front
+        entry.pos = traits_type::handle(container, container.begin()); // fix the reference to it in the lookup map
+        if (entry.timer)
+            timers_.rehandle(entry.timer, entry.pos);
+    }
+
+    static inline std::uint64_t now_ns() {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock_type::now().time_since_epoch()).count());
+    }
+
+    // True once the entry's TTL has run out, whether or not the wheel has
+    // reclaimed it yet.
+    inline bool expired(const entry_type& entry) const {
+        return entry.timer && timers_.expires(entry.timer) <= now_ns();
+    }
+
+    // The entry, or nullptr (after dropping it) if it has expired.
+    inline entry_type* live(entry_type* entry) {
+        if (entry && expired(*entry)){
+            expire_entry(*entry);
+            return nullptr;
+        }
+        return entry;
+    }
+
+    inline void expire_entry(entry_type& entry) {
+        iterator pos = position(entry);
+        stats_.count_expired();
+        weight_ -= weighted ? weigh(*pos) : 0;
+        erase_entry(pos, LRUEvictionCause::expired);
+    }
+
+    // Drops whatever the timer wheel has due and returns how many. Runs at
+    // the start of every write, before anything is looked up.
+    inline size_type reap() {
+        if (timers_.empty())
+            return 0;
+        size_type n = 0;
+        timers_.advance(now_ns(), [this, &n](handle_type h){
+            entry_type* entry = lookupMap.find_at(container, h);
+            entry->timer = 0;               // already released by the wheel
+            expire_entry(*entry);
+            ++n;
+        });
+        return n;
+    }
+
+    // (Re)starts the entry's TTL; zero makes it never expire.
+    inline void set_expiry(entry_type& entry, clock_type::duration ttl) {
+        if (ttl <= clock_type::duration::zero()){
+            if (entry.timer){
+                timers_.cancel(entry.timer);
+                entry.timer = 0;
+            }
+            return;
+        }
+        std::uint64_t now = now_ns();
+        if (timers_.empty())
+            timers_.advance(now, [](handle_type){});    // an idle wheel's time stands still
+        std::uint64_t expires = now + static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(ttl).count());
+        if (entry.timer)
+            timers_.reschedule(entry.timer, expires);
+        else
+            entry.timer = timers_.schedule(entry.pos, expires);
+    }
+
+    // Moves pos to just before dest. Only the segmented policies use it, and
+    // they are refused at construction for containers without splice().
+    inline void relink(iterator dest, iterator pos) {
+        relink(dest, pos, std::integral_constant<bool, lru_detail::has_splice<container_type>::value>());
+    }
+
+    inline void relink(iterator dest, iterator pos, std::true_type) {
+        container.splice(dest, container, pos);
+    }
+
+    inline void relink(iterator, iterator, std::false_type) {}
+
+    inline bool over_budget() const {
+        return weighted ? weight_ > max_size_ : container.size() > max_size_;
+    }
+
+    inline size_type weigh(const_reference kv) const {
+        return weighted ? weigher_(kv.first, kv.second) : 1;
+    }
+
+    // Unit weights: called before inserting.
+    inline void evict_if_full() {
+        if (weighted)
+            return;
+        if (container.size() > max_size())
+            trim(trim_step_);                   // still shrinking after resize()
+        if (container.size() >= max_size()){
+            // if already full, get rid of the oldest one:
+            stats_.count_bounce();
+            evict_one();
+        }
+    }
+
+    // Evicts the entry the policy picks, which is never spare.
+    inline void evict_one(entry_type* spare = nullptr) {
+        iterator pos = victim(spare);
+        weight_ -= weighted ? weigh(*pos) : 0;
+        erase_entry(pos, LRUEvictionCause::capacity);
+    }
+
+    // The tail, as a rule. Under LRUPolicy::tinylfu, once the window is full
+    // its tail is about to leave it and competes with the tail of the main
+    // cache: whichever key the sketch rates less popular goes.
+    iterator victim(entry_type* spare) {
+        if (LRUPolicy::clock == policy_)
+            second_chance();
+        iterator pos = std::prev(container.end());
+        if (LRUPolicy::tinylfu == policy_ && segments_.window_weight >= segments_.window_cap &&
+            at(segments_.window_end) != container.begin()){
+            iterator candidate = std::prev(at(segments_.window_end));
+            if (candidate != pos && !(spare && position(*spare) == candidate) &&
+                ((spare && position(*spare) == pos) ||
+                 sketch_.frequency(hash_(candidate->first)) <= sketch_.frequency(hash_(pos->first))))
+                return candidate;
+        }
+        if (spare && position(*spare) == pos){
+            if (LRUPolicy::clock != policy_)
+                return std::prev(pos);
+            // tail after the sweep: give it the same second chance and go again
+            spare->referenced.store(true);
+            move_to_front(*spare);
+            second_chance();
+            pos = std::prev(container.end());
+        }
+        return pos;
+    }
+
+    inline void erase_entry(iterator pos, LRUEvictionCause cause) {
+        if (segmented() || !timers_.empty()){
+            handle_type h = handle(pos);
+            entry_type& entry = *lookupMap.find_at(container, h);
+            if (entry.timer)
+                timers_.cancel(entry.timer);
+            if (segmented()){
+                if (h == segments_.window_end || h == segments_.probation){
+                    handle_type next = handle(std::next(pos));
+                    if (h == segments_.window_end)
+                        segments_.window_end = next;
+                    if (h == segments_.probation)
+                        segments_.probation = next;
+                }
+                reweigh(entry, size_type(0) - weigh(*pos));
+            }
+        }
+        lookupMap.erase(container, pos->first);             // erase the key from the lookup map
+        if (listener_)
+            notify(pos, cause);                             // the index no longer needs the key
+        container.erase(pos);                               // ...and the container
+    }
+
+    inline void notify(iterator pos, LRUEvictionCause cause) {
+        if (LRUEvictionMode::sync == eviction_mode_)
+            listener_(std::move(pos->first), std::move(pos->second), cause);
+        else
+            evicted_.emplace_back(std::move(pos->first), std::move(pos->second), cause);
+    }
+
+    // Weights: called once the entry has been inserted or its value replaced,
+    // with added being its new weight less what it weighed before (if
+    // anything). Evicts from the tail, never the entry itself, until the
+    // cache is back within budget - or no heavier than before the change
+    // after trim_step_ evictions, while a lazy resize() is in progress.
+    // Returns false if the entry was too heavy to keep and has been removed.
+    bool settle_weight(entry_type& entry, size_type weight, size_type added) {
+        if (!weighted)
+            return true;
+        size_type before = weight_ - (weight - added);  // without it; wraps fine, like added
+        if (weight > max_size_){
+            weight_ = before;
+            stats_.count_bounce();
+            erase_entry(position(entry), LRUEvictionCause::rejected);
+            return false;
+        }
+        weight_ += added;
+        for (size_type n = 0; over_budget() && container.size() > 1 && (n < trim_step_ || weight_ > before); ++n){
+            stats_.count_bounce();
+            evict_one(&entry);
+        }
+        return true;
+    }
+
+    // Links a freshly constructed node (at the front of the container) into the lookup map.
+    inline entry_type& index_front(prehash_type hash) {
+        return lookupMap.insert(container, container.front().first,
+                                entry_type(traits_type::handle(container, container.begin())), hash);
+    }
+
+    template<class K, class V>
+    bool put_impl(K&& key, V&& value, prehash_type hash, clock_type::duration ttl){
+        lru_detail::stopwatch<stats_type::timed> watch;
+        bool inserted = put_entry(std::forward<K>(key), std::forward<V>(value), hash, ttl);
+        stats_.time_put(watch.elapsed());
+        return inserted;
+    }
+
+    template<class K, class V>
+    bool put_entry(K&& key, V&& value, prehash_type hash, clock_type::duration ttl){
+        reap();
+        record(key);
+        entry_type* entry = live(lookupMap.find(container, key, hash));
+        if (!entry){ // it's not in there, need to add a new value
+            evict_if_full();
+            container.emplace_front(std::forward<K>(key), std::forward<V>(value));
+            entry_type& fresh = index_front(hash);
+            size_type w = weigh(container.front());
+            admit(w);
+            if (settle_weight(fresh, w, w))
+                set_expiry(fresh, ttl);
+            return true;
+        }
+        // it exists, replace existing value in place
+        stats_.count_update();
+        iterator pos = position(*entry);
+        size_type old = weigh(*pos);
+        pos->second = std::forward<V>(value);
+        size_type w = weigh(*pos);
+        reweigh(*entry, w - old);
+        set_expiry(*entry, ttl);
+        touch(*entry);
+        settle_weight(*entry, w, w - old);
+        return false;
+    }
+
+    template<class K, class... Args>
+    std::pair<const_iterator, bool> emplace_impl(K&& key, Args&&... args){
+        prehash_type hash = lookupMap.prehash(key);
+        reap();
+        record(key);
+        entry_type* entry = live(lookupMap.find(container, key, hash));
+        if (!entry){
+            return std::make_pair(emplace_new(hash, std::forward<K>(key), std::forward<Args>(args)...), true);
+        }
+        stats_.count_update();
+        iterator pos = position(*entry);
+        size_type old = weigh(*pos);
+        pos->second = TValue(std::forward<Args>(args)...);
+        size_type w = weigh(*pos);
+        reweigh(*entry, w - old);
+        set_expiry(*entry, default_ttl_);
+        const_iterator touched = touch(*entry);
+        if (!settle_weight(*entry, w, w - old))
+            return std::make_pair(end(), false);
+        return std::make_pair(touched, false);
+    }
+
+    template<class K, class... Args>
+    std::pair<const_iterator, bool> try_emplace_impl(K&& key, Args&&... args){
+        prehash_type hash = lookupMap.prehash(key);
+        reap();
+        record(key);
+        entry_type* entry = live(lookupMap.find(container, key, hash));
+        if (!entry){
+            return std::make_pair(emplace_new(hash, std::forward<K>(key), std::forward<Args>(args)...), true);
+        }
+        return std::make_pair(touch(*entry), false);
+    }
+
+    // Returns the new entry's position, or end() if it was too heavy to keep.
+    template<class K, class... Args>
+    const_iterator emplace_new(prehash_type hash, K&& key, Args&&... args){
+        evict_if_full();
+        container.emplace_front(std::piecewise_construct,
+                                std::forward_as_tuple(std::forward<K>(key)),
+                                std::forward_as_tuple(std::forward<Args>(args)...));
+        entry_type& fresh = index_front(hash);
+        size_type w = weigh(container.front());
+        admit(w);
+        if (!settle_weight(fresh, w, w))
+            return end();
+        set_expiry(fresh, default_ttl_);
+        return position(fresh);
+    }
+
     size_type                          max_size_;    
+    LRUPolicy                          policy_;
+    size_type                          trim_step_;  // evictions per insert while over max_size_
+    weigher_type                       weigher_;
+    size_type                          weight_;     // weighted only
+    clock_type::duration               default_ttl_;
+    eviction_listener                  listener_;
+    LRUEvictionMode                    eviction_mode_;
+    eviction_batch                     evicted_;    // LRUEvictionMode::batched, not yet delivered
+    hasher                             hash_;       // LRUPolicy::tinylfu: keys for the sketch
     container_type                     container;
-    std::unordered_map<TKey, iterator> lookupMap;    
+    index_type                         lookupMap;    
+    segment_state                      segments_;
+    LRUFrequencySketch                 sketch_;
+    LRUTimerWheel<handle_type>         timers_;
     // stats/perf:
-    unsigned long long                 cache_hits_;         // get()
-    unsigned long long                 cache_misses_;       // get()
-    unsigned long long                 update_count_;       // put()  - updated value for existing key
-    unsigned long long                 bounce_count_;       // put()  - caused LRU value to be bounced
+    mutable stats_type                 stats_;      // mutable: get_shared() counts into concurrent ones
 };
+
+#endif // LRUCACHE_H
@@ -0,0 +1,291 @@
+// LRUCompactValue.h:
+// A byte-string value type that stores small values inline and compresses large ones
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// LRUCompactValue<Inline, TCodec, CompressAbove> holds a string of bytes.
+// Values of up to Inline bytes (16 by default) live inside the object, so in
+// an LRUSlab they sit in the entry's slot with no allocation of their own.
+// Longer ones go to the heap, and those longer than CompressAbove are
+// compressed with TCodec first, if that saves at least an eighth. Nothing is
+// decompressed until the value is read (str(), copy_to()), so a get() that
+// only checks for a hit, and an eviction, never pay for it.
+//
+//     typedef LRUCompactValue<16, LRULZ4Codec> Value;
+//     LRUCache<std::uint64_t, Value, LRUSlab< std::pair<std::uint64_t, Value> >,
+//              std::hash<std::uint64_t>, std::equal_to<std::uint64_t>,
+//              std::allocator<int>, LRUMemoryWeigher> cache(512 << 20);   // a RAM budget
+//
+// The codecs wrap libraries the header doesn't otherwise need: define
+// LRU_WITH_LZ4 (and link -llz4) for LRULZ4Codec, LRU_WITH_ZSTD (and link
+// -lzstd) for LRUZstdCodec. LRUNoCodec, the default, never compresses.
+//
+#ifndef LRUCOMPACTVALUE_H
+#define LRUCOMPACTVALUE_H
+
+#include "LRUCache.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef LRU_WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef LRU_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+// A codec provides
+//
+//     static std::size_t bound(std::size_t n);        // worst-case compressed size
+//     static std::size_t compress(const char* src, std::size_t n, char* dst, std::size_t capacity);
+//     static bool decompress(const char* src, std::size_t n, char* dst, std::size_t size);
+//
+// where compress() returns the compressed size, or 0 if it failed, and
+// decompress() fills exactly size bytes or returns false.
+struct LRUNoCodec {
+    static const bool enabled = false;
+
+    static inline std::size_t bound(std::size_t n) { return n; }
+    static inline std::size_t compress(const char*, std::size_t, char*, std::size_t) { return 0; }
+    static inline bool decompress(const char*, std::size_t, char*, std::size_t) { return false; }
+};
+
+#ifdef LRU_WITH_LZ4
+// LZ4's default (fast) mode: decompresses at several GB/s.
+struct LRULZ4Codec {
+    static const bool enabled = true;
+
+    static inline std::size_t bound(std::size_t n) { return static_cast<std::size_t>(LZ4_compressBound(static_cast<int>(n))); }
+
+    static inline std::size_t compress(const char* src, std::size_t n, char* dst, std::size_t capacity) {
+        int c = LZ4_compress_default(src, dst, static_cast<int>(n), static_cast<int>(capacity));
+        return c > 0 ? static_cast<std::size_t>(c) : 0;
+    }
+
+    static inline bool decompress(const char* src, std::size_t n, char* dst, std::size_t size) {
+        return LZ4_decompress_safe(src, dst, static_cast<int>(n), static_cast<int>(size)) == static_cast<int>(size);
+    }
+};
+#endif
+
+#ifdef LRU_WITH_ZSTD
+// Zstandard at Level: smaller than LZ4 for JSON-like values, slower to decompress.
+template<int Level = 3>
+struct LRUZstdCodec {
+    static const bool enabled = true;
+
+    static inline std::size_t bound(std::size_t n) { return ZSTD_compressBound(n); }
+
+    static inline std::size_t compress(const char* src, std::size_t n, char* dst, std::size_t capacity) {
+        std::size_t c = ZSTD_compress(dst, capacity, src, n, Level);
+        return ZSTD_isError(c) ? 0 : c;
+    }
+
+    static inline bool decompress(const char* src, std::size_t n, char* dst, std::size_t size) {
+        std::size_t d = ZSTD_decompress(dst, size, src, n);
+        return !ZSTD_isError(d) && d == size;
+    }
+};
+#endif
+
+template<std::size_t Inline = 16, class TCodec = LRUNoCodec, std::size_t CompressAbove = 256>
+class LRUCompactValue {
+    enum : unsigned char { inline_kind, plain_kind, compressed_kind };
+
+    struct heap_ref {
+        char*         data;
+        std::uint32_t stored;       // bytes at data
+    };
+
+    static const std::size_t inline_size = Inline > sizeof(heap_ref) ? Inline : sizeof(heap_ref);
+
+public:
+    LRUCompactValue() : size_(0), kind_(inline_kind) {}
+
+    LRUCompactValue(const void* data, std::size_t n) : size_(0), kind_(inline_kind) { assign(data, n); }
+    LRUCompactValue(const std::string& s) : size_(0), kind_(inline_kind) { assign(s.data(), s.size()); }
+    LRUCompactValue(const char* s) : size_(0), kind_(inline_kind) { assign(s, std::strlen(s)); }
+
+    LRUCompactValue(const LRUCompactValue& other) : size_(other.size_), kind_(other.kind_) {
+        if (kind_ == inline_kind){
+            std::memcpy(u_.bytes, other.u_.bytes, size_);
+            return;
+        }
+        u_.heap.data = static_cast<char*>(::operator new(other.u_.heap.stored));
+        u_.heap.stored = other.u_.heap.stored;
+        std::memcpy(u_.heap.data, other.u_.heap.data, u_.heap.stored);
+    }
+
+    LRUCompactValue(LRUCompactValue&& other) noexcept : size_(other.size_), kind_(other.kind_) {
+        std::memcpy(&u_, &other.u_, sizeof(u_));
+        other.size_ = 0;
+        other.kind_ = inline_kind;
+    }
+
+    LRUCompactValue& operator=(const LRUCompactValue& other) {
+        if (this != &other){
+            LRUCompactValue copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    LRUCompactValue& operator=(LRUCompactValue&& other) noexcept {
+        LRUCompactValue moved(std::move(other));
+        swap(moved);
+        return *this;
+    }
+
+    ~LRUCompactValue() { release(); }
+
+    void swap(LRUCompactValue& other) noexcept {
+        storage u;
+        std::memcpy(&u, &u_, sizeof(u));
+        std::memcpy(&u_, &other.u_, sizeof(u));
+        std::memcpy(&other.u_, &u, sizeof(u));
+        std::swap(size_, other.size_);
+        std::swap(kind_, other.kind_);
+    }
+
+    // Replaces the value with n bytes from data. Throws std::length_error
+    // beyond 4 GB.
+    void assign(const void* data, std::size_t n) {
+        if (n > 0xFFFFFFFFu)
+            throw std::length_error("LRUCompactValue: values are limited to 4 GB");
+        LRUCompactValue fresh;
+        fresh.encode(static_cast<const char*>(data), n);
+        swap(fresh);
+    }
+
+    // Length of the value itself, however it is stored.
+    inline std::size_t size() const  { return size_;      }
+    inline bool        empty() const { return size_ == 0; }
+
+    inline bool is_inline() const     { return kind_ == inline_kind;     }
+    inline bool is_compressed() const { return kind_ == compressed_kind; }
+
+    // What the value takes on the heap (for LRUHeapSizer and
+    // LRUMemoryWeigher): nothing inline, else the stored bytes.
+    inline std::size_t heap_bytes() const {
+        return kind_ == inline_kind ? 0 : lru_detail::allocation_bytes(u_.heap.stored);
+    }
+
+    // Writes the size() bytes of the value to out, decompressing if need be.
+    // Throws std::runtime_error if compressed bytes fail to decompress.
+    void copy_to(void* out) const {
+        switch (kind_){
+        case inline_kind:
+            std::memcpy(out, u_.bytes, size_);
+            break;
+        case plain_kind:
+            std::memcpy(out, u_.heap.data, size_);
+            break;
+        default:
+            if (!TCodec::decompress(u_.heap.data, u_.heap.stored, static_cast<char*>(out), size_))
+                throw std::runtime_error("LRUCompactValue: compressed value is corrupt");
+            break;
+        }
+    }
+
+    std::string str() const {
+        std::string s(size_, '\0');
+        if (size_)
+            copy_to(&s[0]);
+        return s;
+    }
+
+    // Compares the values, not how they happen to be stored.
+    friend bool operator==(const LRUCompactValue& a, const LRUCompactValue& b) {
+        if (a.size_ != b.size_)
+            return false;
+        if (a.kind_ != compressed_kind && b.kind_ != compressed_kind)
+            return std::memcmp(a.bytes(), b.bytes(), a.size_) == 0;
+        return a.str() == b.str();
+    }
+
+    friend bool operator!=(const LRUCompactValue& a, const LRUCompactValue& b) { return !(a == b); }
+
+private:
+    union storage {
+        unsigned char bytes[inline_size];
+        heap_ref      heap;
+    };
+
+    inline const void* bytes() const { return kind_ == inline_kind ? static_cast<const void*>(u_.bytes) : u_.heap.data; }
+
+    // Into an empty value.
+    void encode(const char* data, std::size_t n) {
+        if (n <= Inline){
+            std::memcpy(u_.bytes, data, n);
+            size_ = static_cast<std::uint32_t>(n);
+            return;
+        }
+        if (TCodec::enabled && n > CompressAbove){
+            // compress into a per-thread scratch buffer, keep it only if it saves an eighth
+            static thread_local std::vector<char> scratch;
+            scratch.resize(TCodec::bound(n));
+            std::size_t c = TCodec::compress(data, n, scratch.data(), scratch.size());
+            if (c && c <= n - n / 8){
+                store(scratch.data(), c, compressed_kind);
+                size_ = static_cast<std::uint32_t>(n);
+                return;
+            }
+        }
+        store(data, n, plain_kind);
+        size_ = static_cast<std::uint32_t>(n);
+    }
+
+    void store(const char* data, std::size_t n, unsigned char kind) {
+        u_.heap.data = static_cast<char*>(::operator new(n));
+        u_.heap.stored = static_cast<std::uint32_t>(n);
+        std::memcpy(u_.heap.data, data, n);
+        kind_ = kind;
+    }
+
+    void release() {
+        if (kind_ != inline_kind)
+            ::operator delete(u_.heap.data);
+    }
+
+    storage       u_;
+    std::uint32_t size_;
+    unsigned char kind_;
+};
+
+// Snapshots hold the values themselves, as a length and the bytes, and
+// compress them again on load.
+template<std::size_t Inline, class TCodec, std::size_t CompressAbove>
+struct LRUSnapshotTraits< LRUCompactValue<Inline, TCodec, CompressAbove> > {
+    typedef LRUCompactValue<Inline, TCodec, CompressAbove> value_type;
+    static const bool raw = false;
+
+    static void write(std::ostream& out, const value_type& v) {
+        LRUSnapshotTraits<std::string>::write(out, v.str());
+    }
+
+    static bool read(const char*& p, const char* end, value_type& v) {
+        std::uint64_t n;
+        if (static_cast<std::size_t>(end - p) < sizeof(n))
+            return false;
+        std::memcpy(&n, p, sizeof(n));
+        if (n > static_cast<std::size_t>(end - p) - sizeof(n))
+            return false;
+        v.assign(p + sizeof(n), static_cast<std::size_t>(n));
+        p += sizeof(n) + n;
+        return true;
+    }
+};
+
+#endif // LRUCOMPACTVALUE_H
@@ -0,0 +1,136 @@
+// LRUFrequencySketch.h:
+// A compact, aging popularity estimate for LRUCache's TinyLFU admission
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// A count-min sketch of 4-bit counters, sixteen to a 64-bit word. Each key
+// has one counter in each of four words, and its estimated frequency is the
+// smallest of them, so hash collisions can only ever overestimate. The
+// counters saturate at 15, and once ten increments per word have been
+// recorded every counter is halved, so the estimate follows what is popular
+// now rather than what ever was. About one word per cached entry.
+//
+#ifndef LRUFREQUENCYSKETCH_H
+#define LRUFREQUENCYSKETCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class LRUFrequencySketch {
+public:
+    LRUFrequencySketch() : mask_(0), additions_(0), sample_size_(0) {}
+
+    // Sizes the sketch for about n distinct keys. Growing it forgets what
+    // has been counted so far.
+    void reserve(std::size_t n) {
+        std::size_t words = 8;
+        while (words < n)
+            words *= 2;
+        if (words <= table_.size())
+            return;
+        table_.assign(words, 0);
+        mask_ = words - 1;
+        additions_ = 0;
+        sample_size_ = 10 * words;
+    }
+
+    inline std::size_t capacity() const { return table_.size(); }
+
+    // hash is the key's hash as the cache's hasher computes it.
+    inline unsigned frequency(std::size_t hash) const {
+        if (table_.empty())
+            return 0;
+        std::uint64_t h = spread(hash);
+        unsigned start = static_cast<unsigned>(h & 3) << 2;
+        unsigned freq = 15;
+        for (unsigned i = 0; i < 4; ++i){
+            unsigned count = static_cast<unsigned>(table_[index_of(h, i)] >> ((start + i) << 2)) & 0xF;
+            if (count < freq)
+                freq = count;
+        }
+        return freq;
+    }
+
+    inline void increment(std::size_t hash) {
+        if (table_.empty())
+            return;
+        std::uint64_t h = spread(hash);
+        unsigned start = static_cast<unsigned>(h & 3) << 2;
+        bool added = false;
+        for (unsigned i = 0; i < 4; ++i)
+            added |= increment_at(index_of(h, i), start + i);
+        if (added && ++additions_ == sample_size_)
+            age();
+    }
+
+    inline void clear() {
+        for (std::size_t i = 0; i < table_.size(); ++i)
+            table_[i] = 0;
+        additions_ = 0;
+    }
+
+private:
+    static inline std::uint64_t spread(std::uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // A different word for each of the four counters.
+    inline std::size_t index_of(std::uint64_t h, unsigned i) const {
+        static const std::uint64_t seeds[4] = {
+            0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+        };
+        h = (h + seeds[i]) * seeds[i];
+        h += h >> 32;
+        return static_cast<std::size_t>(h) & mask_;
+    }
+
+    inline bool increment_at(std::size_t word, unsigned counter) {
+        unsigned offset = counter << 2;
+        std::uint64_t mask = std::uint64_t(0xF) << offset;
+        if ((table_[word] & mask) == mask)
+            return false;
+        table_[word] += std::uint64_t(1) << offset;
+        return true;
+    }
+
+    // Halves every counter. The increments still on the books shrink by
+    // the same half, less what the odd counters lose to rounding.
+    void age() {
+        std::size_t odd = 0;
+        for (std::size_t i = 0; i < table_.size(); ++i){
+            odd += popcount(table_[i] & 0x1111111111111111ULL);
+            table_[i] = (table_[i] >> 1) & 0x7777777777777777ULL;
+        }
+        additions_ = (additions_ - (odd >> 2)) >> 1;
+    }
+
+    static inline unsigned popcount(std::uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<unsigned>(__builtin_popcountll(x));
+#else
+        unsigned n = 0;
+        for (; x; x &= x - 1)
+            ++n;
+        return n;
+#endif
+    }
+
+    std::vector<std::uint64_t> table_;
+    std::size_t                mask_;
+    std::size_t                additions_;     // since the last halving
+    std::size_t                sample_size_;
+};
+
+#endif // LRUFREQUENCYSKETCH_H
@@ -0,0 +1,300 @@
+// LRUPoolAllocator.h:
+// A node-recycling pool allocator for LRUCache
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// A cache never holds more than max_size() entries, so it never needs more
+// than max_size() list nodes and max_size() map nodes. LRUPoolAllocator hands
+// single-object allocations out of per-size free lists carved from large
+// chunks, and takes them back onto the same lists, so the node an eviction
+// frees is the very node the incoming entry gets. LRUCache sizes the pool from
+// its constructor's size argument: once each node type has had its first
+// chunk, a cache at capacity no longer calls the global allocator at all.
+// Free blocks stay in the pool; trim() gives back the chunks none of whose
+// blocks are in use, which LRUCache does when it shrinks or is cleared.
+//
+// Multi-object allocations (bucket arrays, vectors) are passed straight to
+// ::operator new. Each default-constructed allocator owns a fresh pool; copies
+// and rebinds share it, which is how a cache's list and map end up drawing
+// from the same pool. A pool is not thread-safe - no more than the cache is.
+//
+#ifndef LRUPOOLALLOCATOR_H
+#define LRUPOOLALLOCATOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace lru_detail {
+    class node_pool {
+    public:
+        // One free list per block size. Blocks are carved from the current
+        // chunk only when the free list is empty, so a large reservation costs
+        // address space but no resident memory until the cache fills up.
+        struct size_class {
+            size_class(std::size_t s) : size(s), free(nullptr), freed(0), next(nullptr), end(nullptr), carved(0) {}
+
+            std::size_t size;
+            void*       free;       // singly linked through the first word of each block
+            std::size_t freed;      // blocks on it
+            char*       next;       // uncarved part of the newest chunk
+            char*       end;
+            std::size_t carved;     // blocks in all chunks so far
+
+            inline std::size_t uncarved() const { return static_cast<std::size_t>(end - next) / size; }
+        };
+
+        // Caps a single chunk, so an unbounded-looking max_size() can't
+        // turn into one huge allocation, and so a cache that shrinks leaves
+        // whole chunks empty for trim() to give back.
+        static const std::size_t max_chunk_blocks = std::size_t(1) << 12;
+
+        node_pool() : hint_(0) {}
+
+        ~node_pool() {
+            for (std::size_t i = 0; i < chunks_.size(); ++i)
+                ::operator delete(chunks_[i].data);
+            for (std::size_t i = 0; i < classes_.size(); ++i)
+                delete classes_[i];
+        }
+
+        // The first chunk of each size class holds this many blocks.
+        inline void reserve(std::size_t n) { hint_ = n; }
+        inline std::size_t capacity_hint() const { return hint_; }
+
+        size_class* class_for(std::size_t size) {
+            if (size < sizeof(void*))
+                size = sizeof(void*);
+            size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+            for (std::size_t i = 0; i < classes_.size(); ++i){
+                if (classes_[i]->size == size)
+                    return classes_[i];
+            }
+            classes_.reserve(classes_.size() + 1);
+            classes_.push_back(new size_class(size));
+            return classes_.back();
+        }
+
+        inline void* allocate(size_class* c) {
+            void* block = c->free;
+            if (block){
+                c->free = *static_cast<void**>(block);
+                --c->freed;
+                return block;
+            }
+            if (c->next == c->end)
+                add_chunk(c);
+            block = c->next;
+            c->next += c->size;
+            return block;
+        }
+
+        inline void deallocate(size_class* c, void* block) {
+            *static_cast<void**>(block) = c->free;
+            c->free = block;
+            ++c->freed;
+        }
+
+        // Bytes in blocks handed out, and in blocks free or not carved yet:
+        // what the pool holds all told, for memory_usage().
+        std::size_t used_bytes() const {
+            std::size_t n = 0;
+            for (std::size_t i = 0; i < classes_.size(); ++i){
+                const size_class& c = *classes_[i];
+                n += (c.carved - c.freed - c.uncarved()) * c.size;
+            }
+            return n;
+        }
+
+        std::size_t spare_bytes() const {
+            std::size_t n = 0;
+            for (std::size_t i = 0; i < classes_.size(); ++i){
+                const size_class& c = *classes_[i];
+                n += (c.freed + c.uncarved()) * c.size;
+            }
+            return n;
+        }
+
+        // Frees every chunk all of whose blocks are free (or not carved
+        // yet), dropping them from the free lists. Blocks never move, so a
+        // chunk with a single block in use stays. Linear in the free blocks.
+        void trim() {
+            std::sort(chunks_.begin(), chunks_.end(),
+                      [](const chunk& a, const chunk& b) { return std::less<char*>()(a.data, b.data); });
+            std::vector<std::size_t> unused(chunks_.size());
+            for (std::size_t i = 0; i < classes_.size(); ++i){
+                for (void* block = classes_[i]->free; block; block = *static_cast<void**>(block))
+                    ++unused[chunk_of(block)];
+            }
+            std::vector<char> empty(chunks_.size());
+            bool any = false;
+            for (std::size_t i = 0; i < chunks_.size(); ++i){
+                const chunk& k = chunks_[i];
+                size_class* c = k.owner;
+                if (c->end == k.data + k.blocks * c->size)     // the newest: its tail was never carved
+                    unused[i] += c->uncarved();
+                empty[i] = unused[i] == k.blocks;
+                any = any || empty[i];
+            }
+            if (!any)
+                return;
+            for (std::size_t i = 0; i < classes_.size(); ++i){
+                size_class* c = classes_[i];
+                void** link = &c->free;
+                c->freed = 0;
+                for (void* block = *link; block; ){
+                    void* next = *static_cast<void**>(block);
+                    if (!empty[chunk_of(block)]){
+                        *link = block;
+                        link = static_cast<void**>(block);
+                        ++c->freed;
+                    }
+                    block = next;
+                }
+                *link = nullptr;
+            }
+            std::size_t kept = 0;
+            for (std::size_t i = 0; i < chunks_.size(); ++i){
+                chunk& k = chunks_[i];
+                if (!empty[i]){
+                    chunks_[kept++] = k;
+                    continue;
+                }
+                size_class* c = k.owner;
+                if (c->end == k.data + k.blocks * c->size)
+                    c->next = c->end = nullptr;
+                c->carved -= k.blocks;
+                ::operator delete(k.data);
+            }
+            chunks_.resize(kept);
+        }
+
+    private:
+        struct chunk {
+            char*       data;
+            size_class* owner;
+            std::size_t blocks;
+        };
+
+        node_pool(const node_pool&);
+        node_pool& operator=(const node_pool&);
+
+        // Which of the (sorted) chunks holds block.
+        std::size_t chunk_of(void* block) const {
+            auto after = std::upper_bound(chunks_.begin(), chunks_.end(), static_cast<char*>(block),
+                                          [](char* p, const chunk& k) { return std::less<char*>()(p, k.data); });
+            return static_cast<std::size_t>(after - chunks_.begin()) - 1;
+        }
+
+        void add_chunk(size_class* c) {
+            // first chunk sized from the hint, later ones double what's there
+            std::size_t blocks = c->carved ? c->carved : (hint_ ? hint_ : 32);
+            if (blocks > max_chunk_blocks)
+                blocks = max_chunk_blocks;
+            chunks_.reserve(chunks_.size() + 1);
+            chunk k = { static_cast<char*>(::operator new(blocks * c->size)), c, blocks };
+            chunks_.push_back(k);
+            c->next = k.data;
+            c->end = k.data + blocks * c->size;
+            c->carved += blocks;
+        }
+
+        std::vector<size_class*> classes_;
+        std::vector<chunk>       chunks_;
+        std::size_t              hint_;
+    };
+}
+
+template<class T>
+class LRUPoolAllocator {
+public:
+    typedef T           value_type;
+    typedef std::size_t size_type;
+
+    // Containers swap pools along with their contents rather than copying
+    // elements between pools.
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template<class U>
+    struct rebind { typedef LRUPoolAllocator<U> other; };
+
+    LRUPoolAllocator()
+        : pool_(std::make_shared<lru_detail::node_pool>()), class_(nullptr)
+    {}
+
+    template<class U>
+    LRUPoolAllocator(const LRUPoolAllocator<U>& other)
+        : pool_(other.pool_), class_(nullptr)
+    {}
+
+    LRUPoolAllocator(const LRUPoolAllocator& other)
+        : pool_(other.pool_), class_(other.class_)
+    {}
+
+    LRUPoolAllocator& operator=(const LRUPoolAllocator& other) {
+        pool_ = other.pool_;
+        class_ = other.class_;
+        return *this;
+    }
+
+    // A copied container gets a pool of its own, sized like this one.
+    LRUPoolAllocator select_on_container_copy_construction() const {
+        LRUPoolAllocator fresh;
+        fresh.reserve(pool_->capacity_hint());
+        return fresh;
+    }
+
+    inline T* allocate(size_type n) {
+        if (n != 1 || alignof(T) > alignof(std::max_align_t))
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        if (!class_)
+            class_ = pool_->class_for(sizeof(T));
+        return static_cast<T*>(pool_->allocate(class_));
+    }
+
+    inline void deallocate(T* p, size_type n) {
+        if (n != 1 || alignof(T) > alignof(std::max_align_t)){
+            ::operator delete(p);
+            return;
+        }
+        if (!class_)
+            class_ = pool_->class_for(sizeof(T));
+        pool_->deallocate(class_, p);
+    }
+
+    // Sizes the first chunk of every node type drawn from this pool. Shared
+    // by all copies, hence const.
+    inline void reserve(size_type n) const { pool_->reserve(n); }
+
+    // Gives back the chunks of the pool that hold no live nodes.
+    inline void trim() const { pool_->trim(); }
+
+    // What the pool holds in nodes handed out, and in nodes kept free for
+    // reuse (see LRUCache::memory_usage()).
+    inline std::size_t used_bytes() const  { return pool_->used_bytes();  }
+    inline std::size_t spare_bytes() const { return pool_->spare_bytes(); }
+
+    template<class U>
+    inline bool operator==(const LRUPoolAllocator<U>& other) const { return pool_ == other.pool_; }
+    template<class U>
+    inline bool operator!=(const LRUPoolAllocator<U>& other) const { return pool_ != other.pool_; }
+
+private:
+    template<class> friend class LRUPoolAllocator;
+
+    std::shared_ptr<lru_detail::node_pool> pool_;
+    lru_detail::node_pool::size_class*     class_;  // resolved on first use
+};
+
+#endif // LRUPOOLALLOCATOR_H
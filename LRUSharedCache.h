@@ -0,0 +1,478 @@
+// LRUSharedCache.h:
+// An LRU cache in shared memory, shared by several processes
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// Everything lives in one mapped segment: a header, the nodes (key, value
+// and 32-bit links) and the bucket array of a chained hash index. Links are
+// node numbers rather than pointers, so the segment works wherever each
+// process happens to map it. Keys and values are copied in and out, and so
+// must be trivially copyable (for byte keys, e.g. std::array<char, 32> with
+// LRUByteHash).
+//
+// Two ways to share one:
+//
+//     LRUSharedCache<K, V> cache(1000000);             // anonymous: shared with
+//                                                      // the processes forked after
+//     LRUSharedCache<K, V> cache("/myapp-cache", 1000000);   // named: any process
+//                                                            // opening the name
+//
+// All processes serialize on one process-shared mutex in the segment. Where
+// robust mutexes exist (Linux), a process dying with the lock held doesn't
+// wedge the others: the next one to lock it finds the cache possibly half
+// updated and clears it. THash must hash equally in every process, which
+// std::hash does for the same executable.
+//
+// An opener waits for the creator of a named segment to size and set it up,
+// but only for so long (the constructor's timeout): if the creator died
+// halfway, or the name belongs to something other than an LRUSharedCache,
+// it throws std::runtime_error rather than hang. Recover a half-created
+// segment by remove()ing the name and creating it again.
+//
+// POSIX only; named segments use shm_open() (link with -lrt on older glibc).
+//
+#ifndef LRUSHAREDCACHE_H
+#define LRUSHAREDCACHE_H
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// FNV-1a over an object's bytes: a hasher for fixed-size byte keys that std::hash
+// doesn't cover. The whole object is hashed, padding included, so keys must
+// be fully initialized - as they must be anyway to compare equal byte for byte.
+template<class T>
+struct LRUByteHash {
+    inline std::size_t operator()(const T& key) const {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(&key);
+        std::uint64_t h = 0xcbf29ce484222325ULL;
+        for (std::size_t i = 0; i < sizeof(T); ++i){
+            h ^= p[i];
+            h *= 0x100000001b3ULL;
+        }
+        return static_cast<std::size_t>(h);
+    }
+};
+
+template<class TKey, class TValue, class THash = std::hash<TKey>, class TKeyEqual = std::equal_to<TKey> >
+class LRUSharedCache {
+    static_assert(std::is_trivially_copyable<TKey>::value && std::is_trivially_copyable<TValue>::value,
+                  "LRUSharedCache keys and values must be trivially copyable");
+
+public:
+    typedef std::size_t                                    size_type;
+    typedef TKey                                           key_type;
+    typedef TValue                                         mapped_type;
+
+    // An anonymous segment for size entries.
+    explicit LRUSharedCache(size_type size) : base_(nullptr), bytes_(0) {
+        check_size(size);
+        bytes_ = segment_bytes(size);
+        void* p = ::mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "LRUSharedCache: mmap");
+        base_ = static_cast<char*>(p);
+        initialize(size);
+    }
+
+    // The named segment name (as for shm_open(), e.g. "/myapp-cache"): created
+    // for size entries if it doesn't exist yet, opened otherwise - in which
+    // case size must match what it was created with, and its creator gets
+    // timeout to finish setting it up.
+    LRUSharedCache(const std::string& name, size_type size,
+                   std::chrono::milliseconds timeout = std::chrono::seconds(5))
+        : base_(nullptr), bytes_(0)
+    {
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+        check_size(size);
+        bytes_ = segment_bytes(size);
+        bool creator = true;
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 && errno == EEXIST){
+            creator = false;
+            fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+        }
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "LRUSharedCache: shm_open " + name);
+        if (creator && ::ftruncate(fd, static_cast<off_t>(bytes_)) != 0){
+            int e = errno;
+            ::close(fd);
+            ::shm_unlink(name.c_str());
+            throw std::system_error(e, std::generic_category(), "LRUSharedCache: ftruncate " + name);
+        }
+        if (!creator)
+            wait_for_size(fd, name, deadline);
+        void* p = ::mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int e = errno;
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw std::system_error(e, std::generic_category(), "LRUSharedCache: mmap " + name);
+        base_ = static_cast<char*>(p);
+        if (creator){
+            initialize(size);
+            return;
+        }
+        wait_for_header(name, deadline);
+        if (header().key_size != sizeof(TKey) || header().value_size != sizeof(TValue) ||
+            header().capacity != size){
+            ::munmap(base_, bytes_);
+            throw std::runtime_error("LRUSharedCache: " + name + " was created for other types or another size");
+        }
+    }
+
+    // Unmaps the segment; a named one persists until remove().
+    ~LRUSharedCache() {
+        if (base_)
+            ::munmap(base_, bytes_);
+    }
+
+    static void remove(const std::string& name) { ::shm_unlink(name.c_str()); }
+
+    // Copies the value out on a hit, promoting the entry.
+    bool get(const TKey& key, TValue& value) {
+        guard lock(*this);
+        index_t n = find(key, bucket_of(key));
+        if (n == npos){
+            ++header().misses;
+            return false;
+        }
+        ++header().hits;
+        move_to_front(n);
+        value = nodes()[n].value;
+        return true;
+    }
+
+    bool peek(const TKey& key, TValue& value) const {
+        guard lock(*this);
+        index_t n = find(key, bucket_of(key));
+        if (n == npos)
+            return false;
+        value = nodes()[n].value;
+        return true;
+    }
+
+    bool is_cached(const TKey& key) const {
+        guard lock(*this);
+        return find(key, bucket_of(key)) != npos;
+    }
+
+    // Inserts key/value, or replaces the value of an existing key in place.
+    // Returns true if the key was newly inserted.
+    bool put(const TKey& key, const TValue& value) {
+        guard lock(*this);
+        segment_header& h = header();
+        index_t b = bucket_of(key);
+        index_t n = find(key, b);
+        if (n != npos){
+            ++h.updates;
+            nodes()[n].value = value;
+            move_to_front(n);
+            return false;
+        }
+        if (h.free == npos){
+            ++h.bounces;
+            evict(h.tail);
+        }
+        n = h.free;
+        node& fresh = nodes()[n];
+        h.free = fresh.next;
+        fresh.key = key;
+        fresh.value = value;
+        fresh.chain = buckets()[b];
+        buckets()[b] = n;
+        link_front(n);
+        ++h.size;
+        return true;
+    }
+
+    void clear() {
+        guard lock(*this);
+        reset();
+    }
+
+    size_type size() const {
+        guard lock(*this);
+        return header().size;
+    }
+
+    inline size_type max_size() const { return header().capacity; }
+    inline bool      empty() const    { return size() == 0; }
+
+    // Counted by all processes together.
+    unsigned long long cache_hits() const   { guard lock(*this); return header().hits;    }
+    unsigned long long cache_misses() const { guard lock(*this); return header().misses;  }
+    unsigned long long update_count() const { guard lock(*this); return header().updates; }
+    unsigned long long bounce_count() const { guard lock(*this); return header().bounces; }
+
+private:
+    LRUSharedCache(const LRUSharedCache&);
+    LRUSharedCache& operator=(const LRUSharedCache&);
+
+    typedef std::uint32_t index_t;
+    static const index_t  npos = index_t(-1);
+
+    struct node {
+        TKey    key;
+        TValue  value;
+        index_t prev;           // towards the front (most recent)
+        index_t next;           // towards the back; the free list when unused
+        index_t chain;          // next node in the same bucket
+    };
+
+    struct segment_header {
+        std::atomic<std::uint64_t> magic;       // 0 until the creator starts setting up
+        std::uint64_t              key_size;
+        std::uint64_t              value_size;
+        std::uint64_t              capacity;
+        std::uint64_t              bucket_mask;
+        std::atomic<std::uint32_t> ready;       // set once the creator is done
+        pthread_mutex_t            lock;
+        index_t                    head;
+        index_t                    tail;
+        index_t                    free;
+        index_t                    size;
+        unsigned long long         hits;
+        unsigned long long         misses;
+        unsigned long long         updates;
+        unsigned long long         bounces;
+    };
+
+    static const std::uint64_t segment_magic = 0x4c5255534841524dULL;     // "LRUSHARM"
+
+    // Locks the segment for the scope; recovers it if its last holder died.
+    class guard {
+    public:
+        explicit guard(const LRUSharedCache& cache) : cache_(const_cast<LRUSharedCache&>(cache)) {
+            int r = ::pthread_mutex_lock(&cache_.header().lock);
+#ifdef __linux__
+            if (r == EOWNERDEAD){
+                cache_.reset();
+                ::pthread_mutex_consistent(&cache_.header().lock);
+                r = 0;
+            }
+#endif
+            if (r != 0)
+                throw std::system_error(r, std::generic_category(), "LRUSharedCache: lock");
+        }
+
+        ~guard() { ::pthread_mutex_unlock(&cache_.header().lock); }
+
+    private:
+        guard(const guard&);
+        guard& operator=(const guard&);
+
+        LRUSharedCache& cache_;
+    };
+
+    static inline void check_size(size_type size) {
+        if (size == 0 || size >= npos)
+            throw std::invalid_argument("LRUSharedCache: size must be between 1 and 2^32 - 2");
+    }
+
+    static inline std::size_t align(std::size_t n, std::size_t a) { return (n + a - 1) / a * a; }
+
+    static inline std::size_t bucket_count(size_type size) {
+        std::size_t n = 1;
+        while (n < size)
+            n *= 2;
+        return n;
+    }
+
+    static inline std::size_t nodes_offset()   { return align(sizeof(segment_header), alignof(node)); }
+    static inline std::size_t buckets_offset(size_type size) {
+        return align(nodes_offset() + size * sizeof(node), alignof(index_t));
+    }
+    static inline std::size_t segment_bytes(size_type size) {
+        return buckets_offset(size) + bucket_count(size) * sizeof(index_t);
+    }
+
+    inline segment_header&       header()        { return *reinterpret_cast<segment_header*>(base_); }
+    inline const segment_header& header() const  { return *reinterpret_cast<const segment_header*>(base_); }
+    inline node*                 nodes() const   { return reinterpret_cast<node*>(base_ + nodes_offset()); }
+    inline index_t*              buckets() const {
+        return reinterpret_cast<index_t*>(base_ + buckets_offset(header().capacity));
+    }
+
+    // Between polls of a segment that isn't ready yet: yields at first,
+    // then sleeps, so a long wait doesn't spin. Throws once past deadline.
+    static void backoff(unsigned& polls, std::chrono::steady_clock::time_point deadline, const std::string& name) {
+        if (std::chrono::steady_clock::now() >= deadline)
+            throw std::runtime_error("LRUSharedCache: timed out waiting for " + name +
+                                     " to be set up (its creator may have died; remove() it and recreate)");
+        if (++polls < 64)
+            ::sched_yield();
+        else
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    void wait_for_size(int fd, const std::string& name, std::chrono::steady_clock::time_point deadline) {
+        struct stat st;
+        for (unsigned polls = 0; ; ){
+            if (::fstat(fd, &st) != 0){
+                int e = errno;
+                ::close(fd);
+                throw std::system_error(e, std::generic_category(), "LRUSharedCache: fstat");
+            }
+            if (static_cast<std::size_t>(st.st_size) >= bytes_)
+                return;
+            if (st.st_size != 0){
+                ::close(fd);
+                throw std::runtime_error("LRUSharedCache: segment was created for another size");
+            }
+            try{
+                backoff(polls, deadline, name);     // the creator hasn't sized it yet
+            }
+            catch (...){
+                ::close(fd);
+                throw;
+            }
+        }
+    }
+
+    // A segment that someone else set up, or didn't: fails at once on a
+    // foreign magic number, and after deadline on a creator that never got
+    // as far as ready.
+    void wait_for_header(const std::string& name, std::chrono::steady_clock::time_point deadline) {
+        for (unsigned polls = 0; ; ){
+            std::uint64_t magic = header().magic.load(std::memory_order_acquire);
+            if (magic != 0 && magic != segment_magic){
+                ::munmap(base_, bytes_);
+                throw std::runtime_error("LRUSharedCache: " + name + " is not an LRUSharedCache segment");
+            }
+            if (magic == segment_magic && header().ready.load(std::memory_order_acquire))
+                return;
+            try{
+                backoff(polls, deadline, name);     // the creator is still setting it up
+            }
+            catch (...){
+                ::munmap(base_, bytes_);
+                throw;
+            }
+        }
+    }
+
+    void initialize(size_type size) {
+        segment_header* h = new (base_) segment_header;
+        h->magic.store(segment_magic, std::memory_order_relaxed);
+        h->key_size = sizeof(TKey);
+        h->value_size = sizeof(TValue);
+        h->capacity = size;
+        h->bucket_mask = bucket_count(size) - 1;
+        pthread_mutexattr_t attr;
+        ::pthread_mutexattr_init(&attr);
+        ::pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef __linux__
+        ::pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+        ::pthread_mutex_init(&h->lock, &attr);
+        ::pthread_mutexattr_destroy(&attr);
+        reset();
+        h->hits = h->misses = h->updates = h->bounces = 0;
+        h->ready.store(1, std::memory_order_release);
+    }
+
+    // Empties the cache: every node onto the free list, every bucket empty.
+    void reset() {
+        segment_header& h = header();
+        node* n = nodes();
+        for (index_t i = 0; i < h.capacity; ++i)
+            n[i].next = i + 1 < h.capacity ? i + 1 : npos;
+        h.free = 0;
+        h.head = h.tail = npos;
+        h.size = 0;
+        index_t* b = buckets();
+        for (std::size_t i = 0; i <= h.bucket_mask; ++i)
+            b[i] = npos;
+    }
+
+    inline index_t bucket_of(const TKey& key) const {
+        // Fibonacci-hash so that weak hashes (like std::hash<int>) still spread
+        std::uint64_t x = static_cast<std::uint64_t>(THash()(key)) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<index_t>((x >> 32) & header().bucket_mask);
+    }
+
+    inline index_t find(const TKey& key, index_t bucket) const {
+        node* n = nodes();
+        index_t i = buckets()[bucket];
+        while (i != npos && !TKeyEqual()(n[i].key, key))
+            i = n[i].chain;
+        return i;
+    }
+
+    inline void unlink(index_t i) {
+        segment_header& h = header();
+        node* n = nodes();
+        if (n[i].prev != npos)
+            n[n[i].prev].next = n[i].next;
+        else
+            h.head = n[i].next;
+        if (n[i].next != npos)
+            n[n[i].next].prev = n[i].prev;
+        else
+            h.tail = n[i].prev;
+    }
+
+    inline void link_front(index_t i) {
+        segment_header& h = header();
+        node* n = nodes();
+        n[i].prev = npos;
+        n[i].next = h.head;
+        if (h.head != npos)
+            n[h.head].prev = i;
+        else
+            h.tail = i;
+        h.head = i;
+    }
+
+    inline void move_to_front(index_t i) {
+        if (header().head == i)
+            return;
+        unlink(i);
+        link_front(i);
+    }
+
+    // Unlinks node i from the list and its bucket, and frees it.
+    void evict(index_t i) {
+        segment_header& h = header();
+        node* n = nodes();
+        unlink(i);
+        index_t* link = &buckets()[bucket_of(n[i].key)];
+        while (*link != i)
+            link = &n[*link].chain;
+        *link = n[i].chain;
+        n[i].next = h.free;
+        h.free = i;
+        --h.size;
+    }
+
+    char*       base_;
+    std::size_t bytes_;
+};
+
+#endif // POSIX
+
+#endif // LRUSHAREDCACHE_H
@@ -0,0 +1,660 @@
+// LRUSlab.h:
+// Contiguous, fixed-capacity storage engine for LRUCache
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// LRUSlab keeps every entry in one preallocated array and builds the recency
+// list out of 32-bit prev/next slot indices, so an entry costs 8 bytes of
+// links and no allocation of its own. Pass it as LRUCache's TContainer:
+//
+//     LRUCache<int, Blob, LRUSlab< std::pair<int, Blob> > > cache(10000000);
+//
+// and the cache switches to LRUSlabIndex, an open-addressing table holding
+// slot numbers instead of copies of the keys.
+//
+#ifndef LRUSLAB_H
+#define LRUSLAB_H
+
+#include "LRUCache.h"
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+template<class T, class TAllocator = std::allocator<T> >
+class LRUSlab {
+    struct node {
+        std::uint32_t prev;
+        std::uint32_t next;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        inline T&       value()       { return *reinterpret_cast<T*>(storage);       }
+        inline const T& value() const { return *reinterpret_cast<const T*>(storage); }
+    };
+
+    typedef typename std::allocator_traits<TAllocator>::template rebind_alloc<node> node_allocator;
+    typedef std::allocator_traits<node_allocator>                                   node_traits;
+
+public:
+    typedef T                   value_type;
+    typedef T&                  reference;
+    typedef const T&            const_reference;
+    typedef std::size_t         size_type;
+    typedef std::ptrdiff_t      difference_type;
+    typedef TAllocator          allocator_type;
+    typedef std::uint32_t       handle_type;    // slot number, stable for the life of the entry
+
+    template<class TSlab, class TRef, class TPtr>
+    class basic_iterator {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef T                               value_type;
+        typedef std::ptrdiff_t                  difference_type;
+        typedef TPtr                            pointer;
+        typedef TRef                            reference;
+
+        basic_iterator() : slab_(nullptr), slot_(0) {}
+        basic_iterator(TSlab* slab, handle_type slot) : slab_(slab), slot_(slot) {}
+
+        // iterator -> const_iterator
+        template<class S, class R, class P>
+        basic_iterator(const basic_iterator<S, R, P>& other) : slab_(other.slab_), slot_(other.slot_) {}
+
+        inline reference operator*() const  { return slab_->nodes_[slot_].value();  }
+        inline pointer   operator->() const { return &slab_->nodes_[slot_].value(); }
+
+        inline basic_iterator& operator++()   { slot_ = slab_->nodes_[slot_].next; return *this; }
+        inline basic_iterator& operator--()   { slot_ = slab_->nodes_[slot_].prev; return *this; }
+        inline basic_iterator  operator++(int) { basic_iterator old(*this); ++*this; return old; }
+        inline basic_iterator  operator--(int) { basic_iterator old(*this); --*this; return old; }
+
+        template<class S, class R, class P>
+        inline bool operator==(const basic_iterator<S, R, P>& other) const { return slot_ == other.slot_; }
+        template<class S, class R, class P>
+        inline bool operator!=(const basic_iterator<S, R, P>& other) const { return slot_ != other.slot_; }
+
+        inline handle_type slot() const { return slot_; }
+
+    private:
+        template<class, class, class> friend class basic_iterator;
+        friend class LRUSlab;
+
+        TSlab*      slab_;
+        handle_type slot_;
+    };
+
+    typedef basic_iterator<LRUSlab, T&, T*>                         iterator;
+    typedef basic_iterator<const LRUSlab, const T&, const T*>       const_iterator;
+
+    explicit LRUSlab(const allocator_type& alloc = allocator_type())
+        : alloc_(alloc), nodes_(nullptr), capacity_(0), size_(0), free_(0)
+    {}
+
+    LRUSlab(const LRUSlab& other)
+        : alloc_(node_traits::select_on_container_copy_construction(other.alloc_))
+        , nodes_(nullptr), capacity_(0), size_(0), free_(0)
+    {
+        copy_from(other);
+    }
+
+    LRUSlab(LRUSlab&& other)
+        : alloc_(std::move(other.alloc_))
+        , nodes_(other.nodes_), capacity_(other.capacity_), size_(other.size_), free_(other.free_)
+    {
+        other.nodes_ = nullptr;
+        other.capacity_ = other.size_ = 0;
+        other.free_ = 0;
+    }
+
+    LRUSlab& operator=(LRUSlab other) {
+        swap(other);
+        return *this;
+    }
+
+    ~LRUSlab() {
+        release();
+    }
+
+    void swap(LRUSlab& other) {
+        using std::swap;
+        swap(alloc_, other.alloc_);
+        swap(nodes_, other.nodes_);
+        swap(capacity_, other.capacity_);
+        swap(size_, other.size_);
+        swap(free_, other.free_);
+    }
+
+    inline iterator       begin()        { return iterator(this, head());       }
+    inline const_iterator begin() const  { return const_iterator(this, head()); }
+    inline const_iterator cbegin() const { return begin();                      }
+    inline iterator       end()          { return iterator(this, 0);            }
+    inline const_iterator end() const    { return const_iterator(this, 0);      }
+    inline const_iterator cend() const   { return end();                        }
+
+    inline reference       front()       { return nodes_[nodes_[0].next].value(); }
+    inline const_reference front() const { return nodes_[nodes_[0].next].value(); }
+    inline reference       back()        { return nodes_[nodes_[0].prev].value(); }
+    inline const_reference back() const  { return nodes_[nodes_[0].prev].value(); }
+
+    inline bool      empty() const    { return size_ == 0; }
+    inline size_type size() const     { return size_;      }
+    inline size_type capacity() const { return capacity_;  }
+    inline size_type max_size() const { return 0xFFFFFFFEu; }   // slot 0 is the list sentinel
+
+    inline allocator_type get_allocator() const { return allocator_type(alloc_); }
+
+    // Preallocates room for n entries; never shrinks. Handles stay valid, but
+    // like std::vector::reserve() this moves the elements and invalidates
+    // references to them.
+    void reserve(size_type n) {
+        if (n > capacity_)
+            grow(n);
+    }
+
+    void clear() {
+        for (handle_type slot = head(); slot != 0; ){
+            handle_type next = nodes_[slot].next;
+            destroy(slot);
+            slot = next;
+        }
+        size_ = 0;
+        if (nodes_){
+            nodes_[0].prev = nodes_[0].next = 0;
+            rebuild_free_list();
+        }
+    }
+
+    template<class... Args>
+    inline iterator emplace(const_iterator pos, Args&&... args) {
+        handle_type slot = allocate_slot();
+        try {
+            node_traits::construct(alloc_, &nodes_[slot].value(), std::forward<Args>(args)...);
+        }
+        catch (...) {
+            release_slot(slot);
+            throw;
+        }
+        link_before(pos.slot_, slot);
+        ++size_;
+        return iterator(this, slot);
+    }
+
+    template<class... Args>
+    inline void emplace_front(Args&&... args) { emplace(begin(), std::forward<Args>(args)...); }
+    template<class... Args>
+    inline void emplace_back(Args&&... args)  { emplace(end(), std::forward<Args>(args)...);   }
+
+    inline void push_front(const T& value) { emplace(begin(), value);            }
+    inline void push_front(T&& value)      { emplace(begin(), std::move(value)); }
+    inline void push_back(const T& value)  { emplace(end(), value);              }
+    inline void push_back(T&& value)       { emplace(end(), std::move(value));   }
+
+    inline iterator erase(const_iterator pos) {
+        handle_type slot = pos.slot_;
+        handle_type next = nodes_[slot].next;
+        unlink(slot);
+        destroy(slot);
+        release_slot(slot);
+        --size_;
+        return iterator(this, next);
+    }
+
+    inline void pop_front() { erase(begin());                            }
+    inline void pop_back()  { erase(const_iterator(this, nodes_[0].prev)); }
+
+    // Relinks the node at it in front of pos. Only splicing within the same
+    // slab is supported; slot numbers are meaningless across slabs.
+    inline void splice(const_iterator pos, LRUSlab& other, const_iterator it) {
+        assert(&other == this);
+        (void)other;
+        if (pos.slot_ == it.slot_ || pos.slot_ == nodes_[it.slot_].next)
+            return;
+        unlink(it.slot_);
+        link_before(pos.slot_, it.slot_);
+    }
+
+    // The links (and padding) of every slot, the sentinel's included, and
+    // the storage of the slots not holding an element.
+    inline size_type link_bytes() const     { return nodes_ ? (capacity_ + 1) * (sizeof(node) - sizeof(T)) : 0; }
+    inline size_type reserved_bytes() const { return nodes_ ? (capacity_ + 1 - size_) * sizeof(T) : 0;     }
+
+    // Calls f(element) for every element in slot order, i.e. the order they
+    // lie in memory, which the hardware prefetcher streams through far
+    // faster than it can chase the recency links.
+    template<class F>
+    void visit(F&& f) const {
+        if (!nodes_)
+            return;
+        for (size_type slot = 1; slot <= capacity_; ++slot)
+            if (nodes_[slot].prev != free_slot)
+                f(nodes_[slot].value());
+    }
+
+    inline iterator       iterator_at(handle_type slot)       { return iterator(this, slot);       }
+    inline const_iterator iterator_at(handle_type slot) const { return const_iterator(this, slot); }
+    inline const_reference at_handle(handle_type slot) const  { return nodes_[slot].value();       }
+
+private:
+    // The prev link of a slot on the free list, telling visit() to skip it;
+    // never a slot number, since those stop below max_size().
+    static const handle_type free_slot = 0xFFFFFFFFu;
+
+    inline handle_type head() const { return nodes_ ? nodes_[0].next : 0; }
+
+    inline void link_before(handle_type pos, handle_type slot) {
+        handle_type prev = nodes_[pos].prev;
+        nodes_[slot].prev = prev;
+        nodes_[slot].next = pos;
+        nodes_[prev].next = slot;
+        nodes_[pos].prev = slot;
+    }
+
+    inline void unlink(handle_type slot) {
+        nodes_[nodes_[slot].prev].next = nodes_[slot].next;
+        nodes_[nodes_[slot].next].prev = nodes_[slot].prev;
+    }
+
+    // Evicted slots go back on the front of the free list, so the next insert
+    // reuses the memory the cache just touched.
+    inline handle_type allocate_slot() {
+        if (free_ == 0)
+            grow(capacity_ ? capacity_ * 2 : 8);
+        handle_type slot = free_;
+        free_ = nodes_[slot].next;
+        return slot;
+    }
+
+    inline void release_slot(handle_type slot) {
+        nodes_[slot].prev = free_slot;
+        nodes_[slot].next = free_;
+        free_ = slot;
+    }
+
+    inline void destroy(handle_type slot) {
+        node_traits::destroy(alloc_, &nodes_[slot].value());
+    }
+
+    void grow(size_type n) {
+        if (n > max_size())
+            throw std::length_error("LRUSlab: capacity exceeds 32-bit slot numbers");
+        node* fresh = node_traits::allocate(alloc_, n + 1);
+        if (nodes_){
+            // live slots keep their numbers, so every handle held by the index stays valid
+            try {
+                transfer(fresh, *this, true);
+            }
+            catch (...) {
+                node_traits::deallocate(alloc_, fresh, n + 1);
+                throw;
+            }
+            handle_type tail = free_;
+            release();
+            nodes_ = fresh;
+            // chain the new slots in front of the existing free list
+            for (size_type slot = n; slot > capacity_; --slot){
+                nodes_[slot].prev = free_slot;
+                nodes_[slot].next = tail;
+                tail = static_cast<handle_type>(slot);
+            }
+            free_ = tail;
+            capacity_ = n;
+        }
+        else{
+            nodes_ = fresh;
+            capacity_ = n;
+            nodes_[0].prev = nodes_[0].next = 0;
+            rebuild_free_list();
+        }
+    }
+
+    inline void rebuild_free_list() {
+        free_ = 0;
+        for (size_type slot = capacity_; slot > 0; --slot){
+            nodes_[slot].prev = free_slot;
+            nodes_[slot].next = free_;
+            free_ = static_cast<handle_type>(slot);
+        }
+    }
+
+    // Copies all links of src (sentinel and free list included) into fresh and
+    // moves or copies the live elements to the same slot numbers.
+    void transfer(node* fresh, LRUSlab& src, bool move) {
+        for (size_type slot = 0; slot <= src.capacity_; ++slot){
+            fresh[slot].prev = src.nodes_[slot].prev;
+            fresh[slot].next = src.nodes_[slot].next;
+        }
+        handle_type slot = src.head();
+        try {
+            for (; slot != 0; slot = src.nodes_[slot].next){
+                if (move)
+                    node_traits::construct(alloc_, &fresh[slot].value(), std::move_if_noexcept(src.nodes_[slot].value()));
+                else
+                    node_traits::construct(alloc_, &fresh[slot].value(), static_cast<const T&>(src.nodes_[slot].value()));
+            }
+        }
+        catch (...) {
+            for (handle_type done = src.head(); done != slot; done = src.nodes_[done].next)
+                node_traits::destroy(alloc_, &fresh[done].value());
+            throw;
+        }
+    }
+
+    void copy_from(const LRUSlab& other) {
+        if (!other.nodes_)
+            return;
+        // same slot numbers as the original, so handles copied along with the
+        // cache's index still line up
+        node* fresh = node_traits::allocate(alloc_, other.capacity_ + 1);
+        try {
+            transfer(fresh, const_cast<LRUSlab&>(other), false);
+        }
+        catch (...) {
+            node_traits::deallocate(alloc_, fresh, other.capacity_ + 1);
+            throw;
+        }
+        nodes_ = fresh;
+        capacity_ = other.capacity_;
+        size_ = other.size_;
+        free_ = other.free_;
+    }
+
+    // Destroys the elements and frees the array without touching the bookkeeping.
+    void release() {
+        if (!nodes_)
+            return;
+        for (handle_type slot = head(); slot != 0; slot = nodes_[slot].next)
+            destroy(slot);
+        node_traits::deallocate(alloc_, nodes_, capacity_ + 1);
+        nodes_ = nullptr;
+    }
+
+    node_allocator alloc_;
+    node*          nodes_;      // nodes_[0] is the sentinel, slots 1..capacity_ hold entries
+    size_type      capacity_;
+    size_type      size_;
+    handle_type    free_;       // head of the free list threaded through next (prev is free_slot), 0 if none
+};
+
+// Open-addressing (linear probing) index over an LRUSlab. Each table cell is
+// a 32-bit hash and a 32-bit slot number, so keys are not duplicated: they are
+// compared against the copy in the slab. Kept at most half full and sized from
+// the slab's capacity, so a preallocated cache never rehashes.
+//
+// When the slab does grow (LRUCache::resize()), the old table isn't rebuilt in
+// one go: a larger table takes all new inserts, and each insert moves a few
+// cells of the old one across, by their cached hashes. Lookups probe
+// both tables until the old one is empty.
+template<class TKey, class TSlab, class TMapped, class THash = std::hash<TKey>, class TKeyEqual = std::equal_to<TKey>,
+         class TAllocator = typename TSlab::allocator_type>
+class LRUSlabIndex {
+    struct cell {
+        std::uint32_t hash;
+        std::uint32_t slot;     // 0 == empty
+    };
+
+    typedef std::allocator_traits<TAllocator>                         alloc_traits;
+    typedef std::vector<cell, typename alloc_traits::template rebind_alloc<cell> >       cell_vector;
+    typedef std::vector<TMapped, typename alloc_traits::template rebind_alloc<TMapped> > mapped_vector;
+
+    // Old-table cells moved across per insert while growing.
+    static const std::size_t migrate_step = 16;
+
+public:
+    typedef std::size_t                   size_type;
+    typedef typename TSlab::handle_type   handle_type;
+
+    LRUSlabIndex(const THash& hash = THash(), const TKeyEqual& equal = TKeyEqual(), const TAllocator& alloc = TAllocator())
+        : cells_(typename cell_vector::allocator_type(alloc))
+        , old_(typename cell_vector::allocator_type(alloc))
+        , mapped_(typename mapped_vector::allocator_type(alloc))
+        , mask_(0), old_mask_(0), migrated_(0), hash_(hash), equal_(equal)
+    {}
+
+    inline void reserve(size_type n) {
+        if (mapped_.size() < n + 1)
+            mapped_.resize(n + 1, TMapped(0));
+        grow(n);
+    }
+
+    // Same as reserve(): the cells already indexed move across lazily.
+    inline void expand(size_type n) { reserve(n); }
+
+    // With transparent THash/TKeyEqual, K can be anything they accept; the
+    // slab index never needs a TKey to look up.
+    template<class K>
+    inline TMapped* find(const TSlab& slab, const K& key) {
+        return find(slab, key, hash_of(key));
+    }
+
+    template<class K>
+    inline const TMapped* find(const TSlab& slab, const K& key) const {
+        return const_cast<LRUSlabIndex*>(this)->find(slab, key, hash_of(key));
+    }
+
+    // mapped.pos must be the slot holding key.
+    inline TMapped& insert(const TSlab& slab, const TKey& key, const TMapped& mapped) {
+        return insert(slab, key, mapped, hash_of(key));
+    }
+
+    // Batch and hash-once paths: the cache hashes a key once, prefetches the
+    // cell it will probe first and then the entry that cell points at, and
+    // only then finds or inserts with the same hash.
+    typedef std::uint32_t prehash_type;
+
+    template<class K>
+    inline prehash_type prehash(const K& key) const { return hash_of(key); }
+
+    inline void prefetch(prehash_type hash) const {
+        if (!cells_.empty())
+            lru_detail::prefetch(&cells_[hash & mask_]);
+    }
+
+    inline void prefetch_entry(const TSlab& slab, prehash_type hash) const {
+        if (!prefetch_entry(slab, cells_, mask_, hash) && migrating())
+            prefetch_entry(slab, old_, old_mask_, hash);
+    }
+
+    template<class K>
+    inline TMapped* find(const TSlab& slab, const K& key, prehash_type hash) {
+        std::size_t pos;
+        if (locate(slab, cells_, mask_, key, hash, pos))
+            return &mapped_[cells_[pos].slot];
+        if (migrating() && locate(slab, old_, old_mask_, key, hash, pos))
+            return &mapped_[old_[pos].slot];
+        return nullptr;
+    }
+
+    inline TMapped& insert(const TSlab& slab, const TKey&, const TMapped& mapped, prehash_type hash) {
+        if (mapped_.size() < slab.capacity() + 1)
+            mapped_.resize(slab.capacity() + 1, TMapped(0));
+        grow(slab.capacity());
+        migrate(migrate_step);
+        cell c = { hash, static_cast<std::uint32_t>(mapped.pos) };
+        place(cells_, mask_, c);
+        mapped_[mapped.pos] = mapped;
+        return mapped_[mapped.pos];
+    }
+
+    inline TMapped* find_at(const TSlab&, handle_type slot) { return &mapped_[slot]; }
+
+    inline void erase(const TSlab& slab, const TKey& key) {
+        std::uint32_t hash = hash_of(key);
+        std::size_t pos;
+        if (locate(slab, cells_, mask_, key, hash, pos))
+            erase_at(cells_, mask_, pos);
+        else if (migrating() && locate(slab, old_, old_mask_, key, hash, pos))
+            erase_at(old_, old_mask_, pos);
+    }
+
+    inline void clear() {
+        for (std::size_t i = 0; i < cells_.size(); ++i)
+            cells_[i].slot = 0;
+        cell_vector(old_.get_allocator()).swap(old_);
+        migrated_ = 0;
+    }
+
+    static const bool stores_keys = false;
+    inline std::size_t memory_bytes() const {
+        return (cells_.capacity() + old_.capacity()) * sizeof(cell) + mapped_.capacity() * sizeof(TMapped);
+    }
+
+    // Once reserved for the slab's capacity, the tables only reallocate
+    // through reserve() and expand(), i.e. when the cache grows.
+    static const bool fixed_storage = true;
+    inline std::size_t slots() const { return cells_.size() + old_.size(); }
+
+private:
+    template<class K>
+    inline std::uint32_t hash_of(const K& key) const {
+        // std::hash is the identity for integers on common implementations;
+        // mix it so sequential keys don't form long probe runs
+        std::uint64_t h = static_cast<std::uint64_t>(hash_(key));
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return static_cast<std::uint32_t>(h);
+    }
+
+    inline bool migrating() const { return !old_.empty(); }
+
+    template<class K>
+    inline bool locate(const TSlab& slab, const cell_vector& cells, std::size_t mask,
+                       const K& key, std::uint32_t hash, std::size_t& pos) const {
+        if (cells.empty())
+            return false;
+        pos = hash & mask;
+        for (;;){
+            const cell& c = cells[pos];
+            if (c.slot == 0)
+                return false;
+            if (c.hash == hash && equal_(slab.at_handle(c.slot).first, key))
+                return true;
+            pos = (pos + 1) & mask;
+        }
+    }
+
+    inline bool prefetch_entry(const TSlab& slab, const cell_vector& cells, std::size_t mask, std::uint32_t hash) const {
+        if (cells.empty())
+            return false;
+        for (std::size_t pos = hash & mask; cells[pos].slot != 0; pos = (pos + 1) & mask){
+            if (cells[pos].hash == hash){
+                lru_detail::prefetch(&slab.at_handle(cells[pos].slot));
+                lru_detail::prefetch(&mapped_[cells[pos].slot]);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static inline void place(cell_vector& cells, std::size_t mask, const cell& c) {
+        std::size_t pos = c.hash & mask;
+        while (cells[pos].slot != 0)
+            pos = (pos + 1) & mask;
+        cells[pos] = c;
+    }
+
+    // backward-shift deletion: pull later cells of the probe run into the
+    // hole so lookups never need tombstones
+    static inline void erase_at(cell_vector& cells, std::size_t mask, std::size_t hole) {
+        std::size_t pos = hole;
+        for (;;){
+            pos = (pos + 1) & mask;
+            if (cells[pos].slot == 0)
+                break;
+            std::size_t home = cells[pos].hash & mask;
+            if (((pos - home) & mask) >= ((pos - hole) & mask)){
+                cells[hole] = cells[pos];
+                hole = pos;
+            }
+        }
+        cells[hole].slot = 0;
+    }
+
+    // Makes room for capacity entries at half load. An empty index just
+    // reallocates; otherwise the current table becomes the old one and drains
+    // into the new one through migrate().
+    void grow(size_type capacity) {
+        std::size_t cells = 8;
+        while (cells < capacity * 2)
+            cells *= 2;
+        if (cells <= cells_.size())
+            return;
+        migrate(std::size_t(-1));       // growing again mid-migration: finish the last one
+        cell_vector fresh(cells, cell(), cells_.get_allocator());
+        fresh.swap(cells_);
+        std::size_t mask = mask_;
+        mask_ = cells - 1;
+        for (std::size_t i = 0; i < fresh.size(); ++i){
+            if (fresh[i].slot != 0){
+                old_.swap(fresh);
+                old_mask_ = mask;
+                migrated_ = 0;
+                return;
+            }
+        }
+    }
+
+    // Takes up to n steps of moving old-table cells across. Erasing from the old table by
+    // backward shift keeps it a valid probe table throughout, and only ever
+    // pulls cells back into the position just emptied, so everything before
+    // migrated_ stays empty.
+    void migrate(std::size_t n) {
+        while (n-- > 0 && migrating()){
+            if (migrated_ == old_.size()){
+                cell_vector(old_.get_allocator()).swap(old_);
+                return;
+            }
+            if (old_[migrated_].slot == 0){
+                ++migrated_;
+                continue;
+            }
+            place(cells_, mask_, old_[migrated_]);
+            erase_at(old_, old_mask_, migrated_);
+        }
+    }
+
+    cell_vector          cells_;
+    cell_vector          old_;      // table being drained, empty unless growing
+    mapped_vector        mapped_;   // indexed by slot number
+    std::size_t          mask_;
+    std::size_t          old_mask_;
+    std::size_t          migrated_; // old_ positions before this are empty
+    THash                hash_;
+    TKeyEqual            equal_;
+};
+
+template<class T, class TAllocator>
+struct LRUContainerTraits< LRUSlab<T, TAllocator> > {
+    typedef LRUSlab<T, TAllocator>              container_type;
+    typedef typename container_type::iterator       iterator;
+    typedef typename container_type::const_iterator const_iterator;
+    typedef typename container_type::handle_type    handle_type;
+
+    template<class TKey, class TMapped, class THash, class TKeyEqual, class TIndexAllocator>
+    struct index {
+        typedef LRUSlabIndex<TKey, container_type, TMapped, THash, TKeyEqual, TIndexAllocator> type;
+    };
+
+    static inline iterator       iterator_at(container_type& c, handle_type h)       { return c.iterator_at(h); }
+    static inline const_iterator iterator_at(const container_type& c, handle_type h) { return c.iterator_at(h); }
+    static inline handle_type    handle(container_type&, iterator pos)               { return pos.slot(); }
+
+    static inline std::size_t link_bytes(const container_type& c)     { return c.link_bytes();     }
+    static inline std::size_t reserved_bytes(const container_type& c) { return c.reserved_bytes(); }
+
+    template<class F>
+    static inline void visit(const container_type& c, F&& f) { c.visit(std::forward<F>(f)); }
+};
+
+#endif // LRUSLAB_H
@@ -0,0 +1,336 @@
+// LRUSnapshot.h:
+// The on-disk format behind LRUCache::save() and load()
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// A snapshot is a 48-byte header followed by the entries, most recently used
+// first. If both key and value are trivially copyable each entry is simply
+// their bytes, back to back, so a record is read with two memcpy()s at a
+// fixed stride; std::string and std::wstring (and other basic_strings of
+// trivially copyable characters) are stored as a 64-bit length and the
+// characters. Any other type needs an LRUSnapshotTraits specialization.
+//
+// Snapshots are written to path.tmp and renamed over path once complete, so
+// a crash mid-save leaves the previous snapshot in place. They are read
+// through mmap() on POSIX systems (read into memory elsewhere), and are only
+// meant to be read back on the machine, or at least the architecture, that
+// wrote them: the header records the byte order and the size of every
+// fixed-size field (a raw key next to a string value included), and a
+// mismatch is refused rather than converted.
+//
+#ifndef LRUSNAPSHOT_H
+#define LRUSNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define LRU_SNAPSHOT_MMAP 1
+#endif
+
+// How a key or value type is stored. raw types are copied byte for byte;
+// the others provide
+//
+//     static void write(std::ostream& out, const T& v);
+//     static bool read(const char*& p, const char* end, T& v);   // false if truncated
+//
+// where read() decodes v from [p, end) and advances p past it.
+template<class T, class = void>
+struct LRUSnapshotTraits {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "LRUSnapshotTraits needs specializing for types that are not trivially copyable");
+    static const bool raw = true;
+};
+
+template<class TChar, class TTraits, class TAlloc>
+struct LRUSnapshotTraits<std::basic_string<TChar, TTraits, TAlloc>,
+                         typename std::enable_if<std::is_trivially_copyable<TChar>::value>::type> {
+    static const bool raw = false;
+
+    static void write(std::ostream& out, const std::basic_string<TChar, TTraits, TAlloc>& s) {
+        std::uint64_t n = s.size();
+        out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+        out.write(reinterpret_cast<const char*>(s.data()), static_cast<std::streamsize>(n * sizeof(TChar)));
+    }
+
+    static bool read(const char*& p, const char* end, std::basic_string<TChar, TTraits, TAlloc>& s) {
+        std::uint64_t n;
+        if (static_cast<std::size_t>(end - p) < sizeof(n))
+            return false;
+        std::memcpy(&n, p, sizeof(n));
+        p += sizeof(n);
+        if (n > static_cast<std::size_t>(end - p) / sizeof(TChar))
+            return false;
+        s.resize(static_cast<std::size_t>(n));
+        if (n)
+            std::memcpy(&s[0], p, static_cast<std::size_t>(n) * sizeof(TChar));
+        p += n * sizeof(TChar);
+        return true;
+    }
+};
+
+namespace lru_detail {
+    struct snapshot_header {
+        char          magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;       // 0x01020304 as the writer stored it
+        std::uint32_t raw;              // fixed-size records of key_size + value_size bytes
+        std::uint32_t reserved;
+        std::uint64_t key_size;         // sizeof for a raw field, variable_field otherwise
+        std::uint64_t value_size;
+        std::uint64_t count;
+    };
+
+    static const char          snapshot_magic[8] = { 'L', 'R', 'U', 'S', 'N', 'A', 'P', 0 };
+    static const std::uint32_t snapshot_version = 2;
+
+    // The field size recorded for a type with LRUSnapshotTraits of its own.
+    // Version 1 recorded sizes only when both fields were raw, 0 otherwise.
+    static const std::uint64_t variable_field = ~std::uint64_t(0);
+
+    template<class TKey, class TValue>
+    struct snapshot_format {
+        static const bool raw = LRUSnapshotTraits<TKey>::raw && LRUSnapshotTraits<TValue>::raw;
+
+        template<class T>
+        static inline std::uint64_t field_size() {
+            return LRUSnapshotTraits<T>::raw ? sizeof(T) : variable_field;
+        }
+
+        // What a writer of this version stores; a version 1 header for version 1.
+        static snapshot_header header(std::uint64_t count, std::uint32_t version = snapshot_version) {
+            snapshot_header h;
+            std::memset(&h, 0, sizeof(h));
+            std::memcpy(h.magic, snapshot_magic, sizeof(h.magic));
+            h.version = version;
+            h.byte_order = 0x01020304;
+            h.raw = raw;
+            if (version >= 2){
+                h.key_size = field_size<TKey>();
+                h.value_size = field_size<TValue>();
+            }
+            else{
+                h.key_size = raw ? sizeof(TKey) : 0;
+                h.value_size = raw ? sizeof(TValue) : 0;
+            }
+            h.count = count;
+            return h;
+        }
+    };
+
+    template<class T>
+    inline void write_field(std::ostream& out, const T& v, std::true_type) {
+        out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+    }
+
+    template<class T>
+    inline void write_field(std::ostream& out, const T& v, std::false_type) {
+        LRUSnapshotTraits<T>::write(out, v);
+    }
+
+    template<class T>
+    inline bool read_field(const char*& p, const char* end, T& v, std::true_type) {
+        if (static_cast<std::size_t>(end - p) < sizeof(T))
+            return false;
+        std::memcpy(static_cast<void*>(&v), p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+
+    template<class T>
+    inline bool read_field(const char*& p, const char* end, T& v, std::false_type) {
+        return LRUSnapshotTraits<T>::read(p, end, v);
+    }
+
+    // Each field by its own type's traits: a raw key may sit next to a
+    // string value.
+    template<class T>
+    inline void write_field(std::ostream& out, const T& v) {
+        write_field(out, v, std::integral_constant<bool, LRUSnapshotTraits<T>::raw>());
+    }
+
+    template<class T>
+    inline bool read_field(const char*& p, const char* end, T& v) {
+        return read_field(p, end, v, std::integral_constant<bool, LRUSnapshotTraits<T>::raw>());
+    }
+
+    // A whole file, read-only: mapped where mmap() is available.
+    class mapped_file {
+    public:
+        explicit mapped_file(const std::string& path) : data_(nullptr), size_(0) {
+#ifdef LRU_SNAPSHOT_MMAP
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("LRUSnapshot: cannot open " + path);
+            struct stat st;
+            if (::fstat(fd, &st) != 0){
+                ::close(fd);
+                throw std::runtime_error("LRUSnapshot: cannot stat " + path);
+            }
+            size_ = static_cast<std::size_t>(st.st_size);
+            if (size_){
+                void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED){
+                    ::close(fd);
+                    throw std::runtime_error("LRUSnapshot: cannot map " + path);
+                }
+                ::madvise(p, size_, MADV_SEQUENTIAL);
+                data_ = static_cast<const char*>(p);
+            }
+            ::close(fd);
+#else
+            std::ifstream in(path.c_str(), std::ios::binary);
+            if (!in)
+                throw std::runtime_error("LRUSnapshot: cannot open " + path);
+            buffer_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            data_ = buffer_.data();
+            size_ = buffer_.size();
+#endif
+        }
+
+        ~mapped_file() {
+#ifdef LRU_SNAPSHOT_MMAP
+            if (data_)
+                ::munmap(const_cast<char*>(data_), size_);
+#endif
+        }
+
+        inline const char* data() const { return data_; }
+        inline std::size_t size() const { return size_; }
+
+    private:
+        mapped_file(const mapped_file&);
+        mapped_file& operator=(const mapped_file&);
+
+        const char*       data_;
+        std::size_t       size_;
+#ifndef LRU_SNAPSHOT_MMAP
+        std::vector<char> buffer_;
+#endif
+    };
+}
+
+// Writes a snapshot entry by entry; nothing replaces path until commit().
+template<class TKey, class TValue>
+class LRUSnapshotWriter {
+    typedef lru_detail::snapshot_format<TKey, TValue> format;
+
+public:
+    explicit LRUSnapshotWriter(const std::string& path)
+        : path_(path), temp_(path + ".tmp"), out_(temp_.c_str(), std::ios::binary | std::ios::trunc), count_(0)
+    {
+        if (!out_)
+            throw std::runtime_error("LRUSnapshot: cannot create " + temp_);
+        lru_detail::snapshot_header h = format::header(0);     // count filled in by commit()
+        out_.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    }
+
+    ~LRUSnapshotWriter() {
+        if (out_.is_open()){                    // never committed
+            out_.close();
+            std::remove(temp_.c_str());
+        }
+    }
+
+    inline void write(const TKey& key, const TValue& value) {
+        lru_detail::write_field(out_, key);
+        lru_detail::write_field(out_, value);
+        ++count_;
+    }
+
+    inline std::uint64_t count() const { return count_; }
+
+    // Finishes the header and moves the snapshot into place.
+    void commit() {
+        lru_detail::snapshot_header h = format::header(count_);
+        out_.seekp(0);
+        out_.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out_.close();
+        if (out_.fail() || std::rename(temp_.c_str(), path_.c_str()) != 0){
+            std::remove(temp_.c_str());
+            throw std::runtime_error("LRUSnapshot: cannot write " + path_);
+        }
+    }
+
+private:
+    LRUSnapshotWriter(const LRUSnapshotWriter&);
+    LRUSnapshotWriter& operator=(const LRUSnapshotWriter&);
+
+    std::string   path_;
+    std::string   temp_;
+    std::ofstream out_;
+    std::uint64_t count_;
+};
+
+// Reads a snapshot back, entry by entry and most recent first, for as long
+// as the caller wants: LRUCache::load_some() takes a few at a time. The
+// header is checked on construction; a snapshot of other types, or from a
+// machine of the other byte order, throws std::runtime_error.
+template<class TKey, class TValue>
+class LRUSnapshotReader {
+    typedef lru_detail::snapshot_format<TKey, TValue> format;
+
+public:
+    explicit LRUSnapshotReader(const std::string& path) : file_(path), read_(0) {
+        lru_detail::snapshot_header h;
+        if (file_.size() < sizeof(h))
+            throw std::runtime_error("LRUSnapshot: " + path + " is not a snapshot");
+        std::memcpy(&h, file_.data(), sizeof(h));
+        if (std::memcmp(h.magic, lru_detail::snapshot_magic, sizeof(h.magic)) != 0 ||
+            h.version == 0 || h.version > lru_detail::snapshot_version)
+            throw std::runtime_error("LRUSnapshot: " + path + " is not a snapshot");
+        lru_detail::snapshot_header expected = format::header(h.count, h.version);
+        if (h.byte_order != expected.byte_order || h.raw != expected.raw ||
+            h.key_size != expected.key_size || h.value_size != expected.value_size)
+            throw std::runtime_error("LRUSnapshot: " + path + " holds other key or value types");
+        count_ = h.count;
+        next_ = file_.data() + sizeof(h);
+        end_ = file_.data() + file_.size();
+        if (format::raw && static_cast<std::uint64_t>(end_ - next_) / (sizeof(TKey) + sizeof(TValue)) < count_)
+            throw std::runtime_error("LRUSnapshot: " + path + " is truncated");
+    }
+
+    // Decodes the next entry; false once there are none left.
+    inline bool next(TKey& key, TValue& value) {
+        if (read_ == count_)
+            return false;
+        if (!lru_detail::read_field(next_, end_, key) || !lru_detail::read_field(next_, end_, value))
+            throw std::runtime_error("LRUSnapshot: snapshot is truncated");
+        ++read_;
+        return true;
+    }
+
+    // Gives up on the rest, e.g. because the cache is full.
+    inline void stop() { read_ = count_; }
+
+    inline bool          done() const      { return read_ == count_; }
+    inline std::uint64_t size() const      { return count_; }
+    inline std::uint64_t remaining() const { return count_ - read_; }
+
+private:
+    lru_detail::mapped_file file_;
+    const char*             next_;
+    const char*             end_;
+    std::uint64_t           count_;
+    std::uint64_t           read_;
+};
+
+#endif // LRUSNAPSHOT_H
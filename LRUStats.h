@@ -0,0 +1,313 @@
+// LRUStats.h:
+// Statistics policies for LRUCache: none, single-threaded or striped
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// LRUCache counts hits, misses, updates, bounces and expiries through its
+// TStats parameter:
+//
+//   LRUNoStats              counts nothing; every call compiles away
+//   LRUStats<>              plain counters, as safe as the cache itself (default)
+//   LRUStripedStats<>       relaxed atomic counters in per-thread stripes, one
+//                           cache line or more apart, summed when read - for
+//                           counting from several threads at once
+//
+// With Timed = true the last two also keep log2 latency histograms of get()
+// and put(). Timing costs two clock reads per call, so it is opt-in.
+//
+#ifndef LRUSTATS_H
+#define LRUSTATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace lru_detail {
+    // Stripes (and ShardedLRUCache's shards) are padded by this so their
+    // writes never share a cache line.
+    static const std::size_t cache_line_size = 64;
+}
+
+// Call counts by latency: bucket i holds calls that took [2^i, 2^(i+1)) ns
+// (bucket 0 also those under 1ns, the last one everything from 2^31ns on).
+struct LRULatencyHistogram {
+    static const std::size_t buckets = 32;
+
+    LRULatencyHistogram() { counts.fill(0); }
+
+    static inline std::size_t bucket_for(std::uint64_t ns) {
+        std::size_t b = 0;
+        while (ns > 1 && b + 1 < buckets){
+            ns >>= 1;
+            ++b;
+        }
+        return b;
+    }
+
+    inline unsigned long long total() const {
+        unsigned long long n = 0;
+        for (std::size_t i = 0; i < buckets; ++i)
+            n += counts[i];
+        return n;
+    }
+
+    // Upper bound, in ns, of the bucket the q-th quantile (0 < q <= 1) falls
+    // in; 0 if nothing was timed.
+    inline std::uint64_t percentile(double q) const {
+        unsigned long long n = total();
+        if (!n)
+            return 0;
+        unsigned long long rank = static_cast<unsigned long long>(q * n + 0.5);
+        unsigned long long seen = 0;
+        for (std::size_t i = 0; i < buckets; ++i){
+            seen += counts[i];
+            if (seen >= rank && counts[i])
+                return std::uint64_t(2) << i;
+        }
+        return std::uint64_t(2) << (buckets - 1);
+    }
+
+    LRULatencyHistogram& operator+=(const LRULatencyHistogram& other) {
+        for (std::size_t i = 0; i < buckets; ++i)
+            counts[i] += other.counts[i];
+        return *this;
+    }
+
+    std::array<unsigned long long, buckets> counts;
+};
+
+// What a cache has counted, as of one moment.
+struct LRUStatsSnapshot {
+    LRUStatsSnapshot() : hits(0), misses(0), updates(0), bounces(0), expired(0) {}
+
+    unsigned long long  hits;           // get()
+    unsigned long long  misses;         // get()
+    unsigned long long  updates;        // put()  - updated value for existing key
+    unsigned long long  bounces;        // put()  - caused LRU value to be bounced
+    unsigned long long  expired;        // dropped when their TTL ran out
+    LRULatencyHistogram get_latency;    // Timed policies only
+    LRULatencyHistogram put_latency;
+
+    LRUStatsSnapshot& operator+=(const LRUStatsSnapshot& other) {
+        hits += other.hits;
+        misses += other.misses;
+        updates += other.updates;
+        bounces += other.bounces;
+        expired += other.expired;
+        get_latency += other.get_latency;
+        put_latency += other.put_latency;
+        return *this;
+    }
+};
+
+namespace lru_detail {
+    // Measures a call when T is true; otherwise reads no clock and reports 0.
+    template<bool T>
+    struct stopwatch {
+        inline std::uint64_t elapsed() const { return 0; }
+    };
+
+    template<>
+    struct stopwatch<true> {
+        stopwatch() : start(std::chrono::steady_clock::now()) {}
+
+        inline std::uint64_t elapsed() const {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+
+        std::chrono::steady_clock::time_point start;
+    };
+
+    enum { stat_hits, stat_misses, stat_updates, stat_bounces, stat_expired, stat_count };
+
+    inline void bump(unsigned long long& c)              { ++c; }
+    inline void bump(std::atomic<unsigned long long>& c) { c.fetch_add(1, std::memory_order_relaxed); }
+
+    struct read_counter {
+        inline unsigned long long operator()(const unsigned long long& c) const { return c; }
+        inline unsigned long long operator()(const std::atomic<unsigned long long>& c) const {
+            return c.load(std::memory_order_relaxed);
+        }
+    };
+
+    struct take_counter {
+        inline unsigned long long operator()(unsigned long long& c) const {
+            unsigned long long n = c;
+            c = 0;
+            return n;
+        }
+        inline unsigned long long operator()(std::atomic<unsigned long long>& c) const {
+            return c.exchange(0, std::memory_order_relaxed);
+        }
+    };
+
+    // The counters behind LRUStats and each stripe of LRUStripedStats. The
+    // histograms shrink to a single unused counter when not Timed.
+    template<class TCounter, bool Timed>
+    struct stats_block {
+        static const std::size_t latency_counters = Timed ? 2 * LRULatencyHistogram::buckets : 1;
+
+        stats_block() { clear(); }
+
+        inline void count(int stat) { bump(counters[stat]); }
+
+        inline void time(std::size_t histogram, std::uint64_t ns) {
+            if (Timed)
+                bump(latency[histogram * LRULatencyHistogram::buckets + LRULatencyHistogram::bucket_for(ns)]);
+        }
+
+        // Adds self's counts to s, reading each counter through f: read_counter
+        // to leave it be, take_counter to zero it.
+        template<class TSelf, class F>
+        static void collect(TSelf& self, LRUStatsSnapshot& s, F f) {
+            s.hits    += f(self.counters[stat_hits]);
+            s.misses  += f(self.counters[stat_misses]);
+            s.updates += f(self.counters[stat_updates]);
+            s.bounces += f(self.counters[stat_bounces]);
+            s.expired += f(self.counters[stat_expired]);
+            if (!Timed)
+                return;
+            for (std::size_t i = 0; i < LRULatencyHistogram::buckets; ++i){
+                s.get_latency.counts[i] += f(self.latency[i]);
+                s.put_latency.counts[i] += f(self.latency[LRULatencyHistogram::buckets + i]);
+            }
+        }
+
+        void clear() {
+            for (std::size_t i = 0; i < stat_count; ++i)
+                counters[i] = 0;
+            for (std::size_t i = 0; i < latency_counters; ++i)
+                latency[i] = 0;
+        }
+
+        TCounter counters[stat_count];
+        TCounter latency[latency_counters];
+    };
+
+    // Each thread's stripe number, handed out round-robin on first use.
+    inline std::size_t thread_stripe() {
+        static std::atomic<std::size_t> next(0);
+        static thread_local std::size_t mine = next.fetch_add(1, std::memory_order_relaxed);
+        return mine;
+    }
+}
+
+// The policy interface LRUCache relies on: enabled, concurrent and timed say
+// what the policy does, count_*() and time_*() record, snapshot() reads and
+// reset() reads and zeroes.
+struct LRUNoStats {
+    static const bool enabled = false;
+    static const bool concurrent = true;        // nothing to race on
+    static const bool timed = false;
+
+    inline void count_hit() {}
+    inline void count_miss() {}
+    inline void count_update() {}
+    inline void count_bounce() {}
+    inline void count_expired() {}
+    inline void time_get(std::uint64_t) {}
+    inline void time_put(std::uint64_t) {}
+
+    inline LRUStatsSnapshot snapshot() const { return LRUStatsSnapshot(); }
+    inline LRUStatsSnapshot reset()          { return LRUStatsSnapshot(); }
+};
+
+template<bool Timed = false>
+class LRUStats {
+public:
+    static const bool enabled = true;
+    static const bool concurrent = false;
+    static const bool timed = Timed;
+
+    inline void count_hit()     { block_.count(lru_detail::stat_hits);    }
+    inline void count_miss()    { block_.count(lru_detail::stat_misses);  }
+    inline void count_update()  { block_.count(lru_detail::stat_updates); }
+    inline void count_bounce()  { block_.count(lru_detail::stat_bounces); }
+    inline void count_expired() { block_.count(lru_detail::stat_expired); }
+    inline void time_get(std::uint64_t ns) { block_.time(0, ns); }
+    inline void time_put(std::uint64_t ns) { block_.time(1, ns); }
+
+    LRUStatsSnapshot snapshot() const {
+        LRUStatsSnapshot s;
+        block_type::collect(block_, s, lru_detail::read_counter());
+        return s;
+    }
+
+    LRUStatsSnapshot reset() {
+        LRUStatsSnapshot s;
+        block_type::collect(block_, s, lru_detail::take_counter());
+        return s;
+    }
+
+private:
+    typedef lru_detail::stats_block<unsigned long long, Timed> block_type;
+
+    block_type block_;
+};
+
+// Threads beyond Stripes share stripes, which stays correct (the counters
+// are atomic) but brings back some of the contention.
+template<bool Timed = false, std::size_t Stripes = 16>
+class LRUStripedStats {
+    static_assert(Stripes > 0, "LRUStripedStats needs at least one stripe");
+
+public:
+    static const bool enabled = true;
+    static const bool concurrent = true;
+    static const bool timed = Timed;
+
+    LRUStripedStats() {}
+
+    // Copies start counting afresh rather than copy counters mid-update.
+    LRUStripedStats(const LRUStripedStats&) {}
+    LRUStripedStats& operator=(const LRUStripedStats&) { return *this; }
+
+    inline void count_hit()     { mine().count(lru_detail::stat_hits);    }
+    inline void count_miss()    { mine().count(lru_detail::stat_misses);  }
+    inline void count_update()  { mine().count(lru_detail::stat_updates); }
+    inline void count_bounce()  { mine().count(lru_detail::stat_bounces); }
+    inline void count_expired() { mine().count(lru_detail::stat_expired); }
+    inline void time_get(std::uint64_t ns) { mine().time(0, ns); }
+    inline void time_put(std::uint64_t ns) { mine().time(1, ns); }
+
+    // Sums the stripes one by one: under concurrent counting the total is
+    // a sum of per-stripe readings, not one instant's.
+    LRUStatsSnapshot snapshot() const {
+        LRUStatsSnapshot s;
+        for (std::size_t i = 0; i < Stripes; ++i)
+            block_type::collect(stripes_[i].block, s, lru_detail::read_counter());
+        return s;
+    }
+
+    // Each counter is swapped for zero, so no concurrent count is lost: it
+    // lands either in the snapshot returned or in the next one.
+    LRUStatsSnapshot reset() {
+        LRUStatsSnapshot s;
+        for (std::size_t i = 0; i < Stripes; ++i)
+            block_type::collect(stripes_[i].block, s, lru_detail::take_counter());
+        return s;
+    }
+
+private:
+    typedef lru_detail::stats_block<std::atomic<unsigned long long>, Timed> block_type;
+
+    struct stripe {
+        block_type block;
+        char       padding[lru_detail::cache_line_size];
+    };
+
+    inline block_type& mine() { return stripes_[lru_detail::thread_stripe() % Stripes].block; }
+
+    stripe stripes_[Stripes];
+};
+
+#endif // LRUSTATS_H
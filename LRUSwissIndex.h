@@ -0,0 +1,547 @@
+// LRUSwissIndex.h:
+// A Swiss-table lookup index for LRUCache over an LRUSlab
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// LRUSwissIndex finds keys the way Swiss tables do: the table is an array of
+// groups, and each group holds a control byte and a slab slot number for 12
+// entries, 64 bytes in all, one cache line. A full entry's control byte is 7
+// bits of its key's hash, so a lookup loads its home group, compares all 12
+// control bytes at once (SSE2 or NEON; one at a time elsewhere) and only
+// reads a key out of the slab where a byte matches. A hit costs the group's
+// cache line and the entry's; std::unordered_map costs a bucket, then a node,
+// before it ever reaches the entry.
+//
+// Use it by giving LRUCache an LRUSwissSlab, an LRUSlab that picks this index:
+//
+//     LRUCache<std::uint64_t, Blob, LRUSwissSlab< std::pair<std::uint64_t, Blob> > > cache(10000000);
+//
+// The index keeps no copies of the keys and only 7 bits of their hashes: one
+// tag match in 128 is a false one, compared against the slab for nothing,
+// and growing the table rehashes keys read back from it. That pays for keys
+// that are cheap to hash and compare - arithmetic types, enums, pointers and
+// strings. Any other key type keeps LRUSlabIndex, whose cells hold 32 bits of
+// hash, unless LRUSwissKey is specialized to say otherwise.
+//
+#ifndef LRUSWISSINDEX_H
+#define LRUSWISSINDEX_H
+
+#include "LRUSlab.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LRU_SWISS_SSE2 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define LRU_SWISS_NEON 1
+#endif
+
+// Whether LRUSwissSlab indexes TKey with LRUSwissIndex (true) or with
+// LRUSlabIndex (false). Specialize it for key types whose hash
+// and equality are cheap.
+template<class TKey>
+struct LRUSwissKey
+    : std::integral_constant<bool, std::is_arithmetic<TKey>::value || std::is_enum<TKey>::value ||
+                                   std::is_pointer<TKey>::value> {};
+
+template<class TChar, class TTraits, class TAlloc>
+struct LRUSwissKey< std::basic_string<TChar, TTraits, TAlloc> > : std::true_type {};
+
+namespace lru_detail {
+    // Control bytes: full entries hold 0..127, their hash's low 7 bits.
+    static const std::int8_t  swiss_empty = -128;
+    static const std::int8_t  swiss_deleted = -2;       // erased from a group that had no empty entry
+    static const std::int8_t  swiss_padding = -1;       // control bytes 12..15, never an entry
+    static const std::size_t  swiss_lanes = 12;
+
+    // Positions within a group, as a bit set. With NEON each position takes
+    // four bits, so the bit number is shifted down by lane_shift.
+    class swiss_mask {
+    public:
+        explicit swiss_mask(std::uint64_t bits) : bits_(bits) {}
+
+        inline bool     any() const { return bits_ != 0; }
+        inline unsigned first() const {
+#if defined(__GNUC__) || defined(__clang__)
+            return static_cast<unsigned>(__builtin_ctzll(bits_)) >> lane_shift;
+#else
+            unsigned n = 0;
+            for (std::uint64_t b = bits_; !(b & 1); b >>= 1)
+                ++n;
+            return n >> lane_shift;
+#endif
+        }
+        inline void     pop() { bits_ &= bits_ - 1; }
+
+    private:
+#ifdef LRU_SWISS_NEON
+        static const unsigned lane_shift = 2;
+#else
+        static const unsigned lane_shift = 0;
+#endif
+
+        std::uint64_t bits_;
+    };
+
+    // The 16 control bytes at the start of a group.
+    class swiss_control {
+    public:
+        explicit swiss_control(const std::int8_t* ctrl) {
+#if defined(LRU_SWISS_SSE2)
+            ctrl_ = _mm_load_si128(reinterpret_cast<const __m128i*>(ctrl));
+#elif defined(LRU_SWISS_NEON)
+            ctrl_ = vld1q_s8(ctrl);
+#else
+            std::memcpy(ctrl_, ctrl, sizeof(ctrl_));
+#endif
+        }
+
+        inline swiss_mask match(std::int8_t tag) const {
+#if defined(LRU_SWISS_SSE2)
+            return lanes(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl_, _mm_set1_epi8(tag))));
+#elif defined(LRU_SWISS_NEON)
+            return lanes(vceqq_s8(ctrl_, vdupq_n_s8(tag)));
+#else
+            return scalar([tag](std::int8_t c) { return c == tag; });
+#endif
+        }
+
+        inline swiss_mask match_empty() const {
+#if defined(LRU_SWISS_SSE2)
+            return lanes(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl_, _mm_set1_epi8(swiss_empty))));
+#elif defined(LRU_SWISS_NEON)
+            return lanes(vceqq_s8(ctrl_, vdupq_n_s8(swiss_empty)));
+#else
+            return scalar([](std::int8_t c) { return c == swiss_empty; });
+#endif
+        }
+
+        // Empty or deleted: where an insert may go.
+        inline swiss_mask match_free() const {
+#if defined(LRU_SWISS_SSE2)
+            return lanes(_mm_movemask_epi8(ctrl_));
+#elif defined(LRU_SWISS_NEON)
+            return lanes(vcltq_s8(ctrl_, vdupq_n_s8(0)));
+#else
+            return scalar([](std::int8_t c) { return c < 0; });
+#endif
+        }
+
+    private:
+#if defined(LRU_SWISS_SSE2)
+        static inline swiss_mask lanes(int bits) {
+            return swiss_mask(static_cast<std::uint64_t>(bits) & ((1u << swiss_lanes) - 1));
+        }
+
+        __m128i ctrl_;
+#elif defined(LRU_SWISS_NEON)
+        // Narrows each byte of the comparison to a nibble of a 64-bit word.
+        static inline swiss_mask lanes(uint8x16_t eq) {
+            uint8x8_t narrow = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+            std::uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(narrow), 0);
+            return swiss_mask(bits & 0x0000888888888888ULL);
+        }
+
+        int8x16_t ctrl_;
+#else
+        template<class F>
+        inline swiss_mask scalar(F f) const {
+            std::uint64_t bits = 0;
+            for (std::size_t i = 0; i < swiss_lanes; ++i)
+                if (f(ctrl_[i]))
+                    bits |= std::uint64_t(1) << i;
+            return swiss_mask(bits);
+        }
+
+        std::int8_t ctrl_[16];
+#endif
+    };
+}
+
+// The index itself; see the top of the file. Kept at most 7/8 full, counting
+// deleted entries, and sized from the slab's capacity, so a preallocated cache
+// never grows it. Like LRUSlabIndex, a table that has to grow (or to be
+// rebuilt to clear out deleted entries) is replaced by a new one that takes
+// the inserts, while each insert moves a few entries of the old one across,
+// and lookups probe both until the old one is empty.
+template<class TKey, class TSlab, class TMapped, class THash = std::hash<TKey>, class TKeyEqual = std::equal_to<TKey>,
+         class TAllocator = typename TSlab::allocator_type>
+class LRUSwissIndex {
+    typedef std::allocator_traits<TAllocator>                                            alloc_traits;
+    typedef std::vector<std::uint32_t, typename alloc_traits::template rebind_alloc<std::uint32_t> > word_vector;
+    typedef std::vector<TMapped, typename alloc_traits::template rebind_alloc<TMapped> > mapped_vector;
+
+    // A group is 16 words: the control bytes, then the slot numbers.
+    static const std::size_t group_words = 16;
+    static const std::size_t slot_offset = 4;
+
+    // Old-table entries moved across per insert while growing.
+    static const std::size_t migrate_step = 16;
+
+    // The groups live in a vector of words, from its first 64-byte boundary on.
+    class table {
+    public:
+        typedef typename word_vector::allocator_type allocator_type;
+
+        explicit table(const allocator_type& alloc) : words_(alloc), base_(nullptr), groups_(0), size_(0), free_(0) {}
+        table(const table& other)
+            : words_(other.words_), base_(nullptr), groups_(other.groups_), size_(other.size_), free_(other.free_)
+        {
+            realign();
+        }
+        table& operator=(const table& other) {
+            table copy(other);
+            swap(copy);
+            return *this;
+        }
+
+        void swap(table& other) {
+            using std::swap;
+            words_.swap(other.words_);
+            swap(base_, other.base_);
+            swap(groups_, other.groups_);
+            swap(size_, other.size_);
+            swap(free_, other.free_);
+        }
+
+        void allocate(std::size_t groups) {
+            words_.assign(groups * group_words + group_words - 1, 0);
+            groups_ = groups;
+            realign();
+            clear();
+        }
+
+        void release() {
+            word_vector(words_.get_allocator()).swap(words_);
+            groups_ = 0;
+            realign();
+        }
+
+        void clear() {
+            for (std::size_t g = 0; g < groups_; ++g){
+                std::int8_t* c = ctrl(g);
+                std::memset(c, swiss_empty_byte(), lru_detail::swiss_lanes);
+                std::memset(c + lru_detail::swiss_lanes, swiss_padding_byte(), 16 - lru_detail::swiss_lanes);
+            }
+            size_ = 0;
+            free_ = static_cast<std::ptrdiff_t>(groups_ * lru_detail::swiss_lanes * 7 / 8);
+        }
+
+        inline allocator_type get_allocator() const { return words_.get_allocator(); }
+        inline std::size_t    bytes() const         { return words_.capacity() * sizeof(std::uint32_t); }
+
+        inline bool          empty() const      { return groups_ == 0; }
+        inline std::size_t   groups() const     { return groups_; }
+        inline std::size_t   size() const       { return size_; }
+        inline std::size_t   lanes() const      { return groups_ * lru_detail::swiss_lanes; }
+        inline bool          crowded() const    { return free_ <= 0; }
+
+        inline std::int8_t*       ctrl(std::size_t g)       { return reinterpret_cast<std::int8_t*>(base_ + g * group_words); }
+        inline const std::int8_t* ctrl(std::size_t g) const { return reinterpret_cast<const std::int8_t*>(base_ + g * group_words); }
+        inline std::uint32_t&       slot(std::size_t g, std::size_t i)       { return base_[g * group_words + slot_offset + i]; }
+        inline const std::uint32_t& slot(std::size_t g, std::size_t i) const { return base_[g * group_words + slot_offset + i]; }
+
+        // Where hash's probe sequence starts: its top bits, as a group number.
+        inline std::size_t home(std::uint32_t hash) const {
+            return static_cast<std::size_t>((static_cast<std::uint64_t>(hash) * groups_) >> 32);
+        }
+
+        // Puts slot in the first group along hash's probe sequence with room.
+        // There always is some: the table is never let fill up.
+        void place(std::uint32_t hash, std::uint32_t s) {
+            std::size_t g = home(hash);
+            for (std::size_t step = 1; ; ++step){
+                lru_detail::swiss_mask room = lru_detail::swiss_control(ctrl(g)).match_free();
+                if (room.any()){
+                    std::size_t i = room.first();
+                    if (ctrl(g)[i] == lru_detail::swiss_empty)
+                        --free_;
+                    ctrl(g)[i] = tag_of(hash);
+                    slot(g, i) = s;
+                    ++size_;
+                    return;
+                }
+                g = (g + step) & (groups_ - 1);
+            }
+        }
+
+        // A group that still has an empty entry ends every probe sequence
+        // through it, so an entry erased from it can become empty again;
+        // elsewhere it must stay a deleted marker for probes to pass over.
+        void erase(std::size_t g, std::size_t i) {
+            if (lru_detail::swiss_control(ctrl(g)).match_empty().any()){
+                ctrl(g)[i] = lru_detail::swiss_empty;
+                ++free_;
+            }
+            else{
+                ctrl(g)[i] = lru_detail::swiss_deleted;
+            }
+            --size_;
+        }
+
+    private:
+        static inline int swiss_empty_byte()   { return static_cast<unsigned char>(lru_detail::swiss_empty);   }
+        static inline int swiss_padding_byte() { return static_cast<unsigned char>(lru_detail::swiss_padding); }
+
+        inline void realign() {
+            std::uintptr_t p = reinterpret_cast<std::uintptr_t>(words_.data());
+            base_ = words_.empty() ? nullptr
+                  : words_.data() + ((lru_detail::cache_line_size - p % lru_detail::cache_line_size) % lru_detail::cache_line_size) / sizeof(std::uint32_t);
+        }
+
+        word_vector    words_;
+        std::uint32_t* base_;
+        std::size_t    groups_;
+        std::size_t    size_;
+        std::ptrdiff_t free_;           // empty entries left before the 7/8 limit
+    };
+
+public:
+    typedef std::size_t                   size_type;
+    typedef typename TSlab::handle_type   handle_type;
+
+    LRUSwissIndex(const THash& hash = THash(), const TKeyEqual& equal = TKeyEqual(), const TAllocator& alloc = TAllocator())
+        : cells_(typename table::allocator_type(alloc))
+        , old_(typename table::allocator_type(alloc))
+        , mapped_(typename mapped_vector::allocator_type(alloc))
+        , migrated_(0), wanted_(0), hash_(hash), equal_(equal)
+    {}
+
+    // An empty index allocates its table now; one already in use leaves
+    // growing to the next insert, which can read the keys it has to move.
+    inline void reserve(size_type n) {
+        if (mapped_.size() < n + 1)
+            mapped_.resize(n + 1, TMapped(0));
+        wanted_ = std::max(wanted_, n);
+        if (cells_.size() == 0 && !migrating() && groups_for(n) > cells_.groups())
+            cells_.allocate(groups_for(n));
+    }
+
+    inline void expand(size_type n) { reserve(n); }
+
+    // With transparent THash/TKeyEqual, K can be anything they accept.
+    template<class K>
+    inline TMapped* find(const TSlab& slab, const K& key) {
+        return find(slab, key, hash_of(key));
+    }
+
+    template<class K>
+    inline const TMapped* find(const TSlab& slab, const K& key) const {
+        return const_cast<LRUSwissIndex*>(this)->find(slab, key, hash_of(key));
+    }
+
+    // mapped.pos must be the slot holding key.
+    inline TMapped& insert(const TSlab& slab, const TKey& key, const TMapped& mapped) {
+        return insert(slab, key, mapped, hash_of(key));
+    }
+
+    typedef std::uint32_t prehash_type;
+
+    template<class K>
+    inline prehash_type prehash(const K& key) const { return hash_of(key); }
+
+    inline void prefetch(prehash_type hash) const {
+        if (!cells_.empty())
+            lru_detail::prefetch(cells_.ctrl(cells_.home(hash)));
+    }
+
+    inline void prefetch_entry(const TSlab& slab, prehash_type hash) const {
+        if (!prefetch_entry(slab, cells_, hash) && migrating())
+            prefetch_entry(slab, old_, hash);
+    }
+
+    template<class K>
+    inline TMapped* find(const TSlab& slab, const K& key, prehash_type hash) {
+        std::size_t g, i;
+        if (locate(slab, cells_, key, hash, g, i))
+            return &mapped_[cells_.slot(g, i)];
+        if (migrating() && locate(slab, old_, key, hash, g, i))
+            return &mapped_[old_.slot(g, i)];
+        return nullptr;
+    }
+
+    inline TMapped& insert(const TSlab& slab, const TKey&, const TMapped& mapped, prehash_type hash) {
+        if (mapped_.size() < slab.capacity() + 1)
+            mapped_.resize(slab.capacity() + 1, TMapped(0));
+        wanted_ = std::max<size_type>(wanted_, slab.capacity());
+        grow(slab);
+        migrate(slab, migrate_step);
+        cells_.place(hash, static_cast<std::uint32_t>(mapped.pos));
+        mapped_[mapped.pos] = mapped;
+        return mapped_[mapped.pos];
+    }
+
+    inline TMapped* find_at(const TSlab&, handle_type slot) { return &mapped_[slot]; }
+
+    inline void erase(const TSlab& slab, const TKey& key) {
+        std::uint32_t hash = hash_of(key);
+        std::size_t g, i;
+        if (locate(slab, cells_, key, hash, g, i))
+            cells_.erase(g, i);
+        else if (migrating() && locate(slab, old_, key, hash, g, i))
+            old_.erase(g, i);
+    }
+
+    inline void clear() {
+        cells_.clear();
+        old_.release();
+        migrated_ = 0;
+    }
+
+    static const bool stores_keys = false;
+    inline std::size_t memory_bytes() const {
+        return cells_.bytes() + old_.bytes() + mapped_.capacity() * sizeof(TMapped);
+    }
+
+    // A table crowded with deleted controls is rebuilt in the middle of
+    // inserts, so the memory a lookup reads can go away under it.
+    static const bool fixed_storage = false;
+    inline std::size_t slots() const { return cells_.lanes() + old_.lanes(); }
+
+private:
+    template<class K>
+    inline std::uint32_t hash_of(const K& key) const {
+        // as in LRUSlabIndex: the tag and the home group both need bits that
+        // std::hash's identity on integers doesn't vary
+        std::uint64_t h = static_cast<std::uint64_t>(hash_(key));
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return static_cast<std::uint32_t>(h);
+    }
+
+    static inline std::int8_t tag_of(std::uint32_t hash) { return static_cast<std::int8_t>(hash & 0x7F); }
+
+    // Enough groups for n entries at 7/8 full, a power of two.
+    static inline std::size_t groups_for(size_type n) {
+        std::size_t groups = 1;
+        while (groups * lru_detail::swiss_lanes * 7 / 8 < n)
+            groups *= 2;
+        return groups;
+    }
+
+    inline bool migrating() const { return !old_.empty(); }
+
+    // Probes group by group, triangularly, which visits every group of a
+    // power-of-two table; a group with an empty entry ends the probe.
+    template<class K>
+    inline bool locate(const TSlab& slab, const table& t, const K& key, std::uint32_t hash,
+                       std::size_t& g, std::size_t& i) const {
+        if (t.empty())
+            return false;
+        std::int8_t tag = tag_of(hash);
+        g = t.home(hash);
+        for (std::size_t step = 1; step <= t.groups(); ++step){
+            lru_detail::swiss_control ctrl(t.ctrl(g));
+            for (lru_detail::swiss_mask m = ctrl.match(tag); m.any(); m.pop()){
+                i = m.first();
+                if (equal_(slab.at_handle(t.slot(g, i)).first, key))
+                    return true;
+            }
+            if (ctrl.match_empty().any())
+                return false;
+            g = (g + step) & (t.groups() - 1);
+        }
+        return false;
+    }
+
+    inline bool prefetch_entry(const TSlab& slab, const table& t, std::uint32_t hash) const {
+        if (t.empty())
+            return false;
+        std::size_t g = t.home(hash);
+        lru_detail::swiss_mask m = lru_detail::swiss_control(t.ctrl(g)).match(tag_of(hash));
+        if (!m.any())
+            return false;
+        std::uint32_t s = t.slot(g, m.first());
+        lru_detail::prefetch(&slab.at_handle(s));
+        lru_detail::prefetch(&mapped_[s]);
+        return true;
+    }
+
+    // Swaps in a larger table once the slab has outgrown this one, or a
+    // fresh one of the same size once deleted markers have used up the
+    // spare room; the old one drains through migrate().
+    void grow(const TSlab& slab) {
+        std::size_t groups = groups_for(wanted_);
+        bool larger = groups > cells_.groups();
+        if (!larger && !cells_.crowded())
+            return;
+        if (migrating()){
+            if (!larger)
+                return;                 // the table being drained frees the room soon enough
+            migrate(slab, std::size_t(-1));
+        }
+        if (cells_.size() == 0){
+            cells_.allocate(std::max(groups, cells_.groups()));
+            return;
+        }
+        table fresh(cells_.get_allocator());
+        fresh.allocate(std::max(groups, cells_.groups()));
+        fresh.swap(cells_);
+        old_.swap(fresh);
+        migrated_ = 0;
+    }
+
+    // Takes up to n steps of moving old-table entries across, leaving deleted
+    // markers behind so the old table stays a valid probe table throughout.
+    void migrate(const TSlab& slab, std::size_t n) {
+        while (n-- > 0 && migrating()){
+            if (migrated_ == old_.lanes() || old_.size() == 0){
+                old_.release();
+                return;
+            }
+            std::size_t g = migrated_ / lru_detail::swiss_lanes, i = migrated_ % lru_detail::swiss_lanes;
+            ++migrated_;
+            if (old_.ctrl(g)[i] < 0)
+                continue;
+            std::uint32_t s = old_.slot(g, i);
+            cells_.place(hash_of(slab.at_handle(s).first), s);
+            old_.erase(g, i);
+        }
+    }
+
+    table         cells_;
+    table         old_;         // table being drained, empty unless growing
+    mapped_vector mapped_;      // indexed by slot number
+    std::size_t   migrated_;    // old_ entries before this one are moved or empty
+    size_type     wanted_;      // entries to size cells_ for
+    THash         hash_;
+    TKeyEqual     equal_;
+};
+
+// An LRUSlab whose cache indexes it with LRUSwissIndex. Pass it as
+// LRUCache's TContainer, like LRUSlab.
+template<class T, class TAllocator = std::allocator<T> >
+class LRUSwissSlab : public LRUSlab<T, TAllocator> {
+public:
+    explicit LRUSwissSlab(const TAllocator& alloc = TAllocator()) : LRUSlab<T, TAllocator>(alloc) {}
+};
+
+template<class T, class TAllocator>
+struct LRUContainerTraits< LRUSwissSlab<T, TAllocator> > : LRUContainerTraits< LRUSlab<T, TAllocator> > {
+    typedef LRUSwissSlab<T, TAllocator> container_type;
+
+    template<class TKey, class TMapped, class THash, class TKeyEqual, class TIndexAllocator>
+    struct index {
+        typedef typename std::conditional<LRUSwissKey<TKey>::value,
+            LRUSwissIndex<TKey, container_type, TMapped, THash, TKeyEqual, TIndexAllocator>,
+            LRUSlabIndex<TKey, container_type, TMapped, THash, TKeyEqual, TIndexAllocator> >::type type;
+    };
+};
+
+#endif // LRUSWISSINDEX_H
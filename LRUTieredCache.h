@@ -0,0 +1,478 @@
+// LRUTieredCache.h:
+// An LRUCache in RAM backed by a log-structured second tier on flash
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+//     LRUTieredCache<std::string, Blob> cache(100000, "/ssd/cache.log", 64ull << 30);
+//
+// The RAM tier is an ordinary cache (TCache). What it evicts for room is
+// demoted, through its batched eviction listener, into the flash tier: a
+// file used as a ring of fixed-size segments, written one whole segment at
+// a time. Records (the key and value, encoded as in a snapshot, so any type
+// with LRUSnapshotTraits works) are appended to the segment being filled in
+// memory; a full segment is handed to a writer thread, and the segment after
+// it in the ring is reclaimed, forgetting whatever it held - the flash tier
+// evicts in FIFO order, a segment at a time. Only an index of record
+// locations stays in memory.
+//
+// get() looks in RAM first. On a miss there it looks the key up in the
+// flash index, reads the record with pread() - without holding the lock -
+// and promotes the entry back to RAM; the two tiers never hold the same key.
+// Records not yet written are read straight from their segment's buffer.
+// Expired entries are not demoted, and a demoted entry loses its TTL.
+//
+// One mutex guards both tiers and the index; it is never held across a
+// read or write of the file. put() waits only when max_pending segments are
+// already queued for the writer. The file is unlinked as soon as it has been
+// created: its contents mean nothing without the index, and the space goes
+// back to the file system when the cache is destroyed, or if the process
+// dies.
+//
+// POSIX only.
+//
+#ifndef LRUTIEREDCACHE_H
+#define LRUTIEREDCACHE_H
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include "LRUCache.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lru_detail {
+    // An output stream buffer appending to a vector: what demoted entries
+    // are encoded through.
+    class vector_streambuf : public std::streambuf {
+    public:
+        explicit vector_streambuf(std::vector<char>& out) : out_(out) {}
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (!traits_type::eq_int_type(c, traits_type::eof()))
+                out_.push_back(traits_type::to_char_type(c));
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char* s, std::streamsize n) override {
+            out_.insert(out_.end(), s, s + n);
+            return n;
+        }
+
+    private:
+        std::vector<char>& out_;
+    };
+}
+
+template<class TKey, class TValue, class TCache = LRUCache<TKey, TValue> >
+class LRUTieredCache {
+    // Where a demoted entry's record is. Segment numbers only ever grow, so
+    // a location is never mistaken for one in a later segment in its slot.
+    // One with claimed set in segment is a claim instead: the entry is on
+    // its way to flash, and segment tells this demotion from a later one.
+    struct location {
+        std::uint64_t segment;
+        std::uint32_t offset;
+        std::uint32_t length;
+    };
+
+    static const std::uint64_t claimed = std::uint64_t(1) << 63;
+
+    // A segment's bytes while it is being filled or waits for the writer.
+    struct segment_buffer {
+        explicit segment_buffer(std::size_t size) : data(new char[size]), used(0) {}
+
+        std::unique_ptr<char[]> data;
+        std::size_t             used;
+    };
+
+    typedef std::unordered_map<TKey, location, typename TCache::hasher, typename TCache::key_equal> flash_index;
+
+public:
+    typedef TCache                                         cache_type;
+    typedef typename cache_type::size_type                 size_type;
+    typedef typename cache_type::eviction_batch            eviction_batch;
+
+    // Full segments queued for the writer before put() waits for it.
+    static const std::size_t max_pending = 4;
+
+    // size entries in RAM, and a flash tier of flash_bytes at path, in
+    // segments of segment_bytes (at most 4 GB). Throws std::invalid_argument
+    // if that makes fewer than max_pending + 2 segments, and
+    // std::system_error if the file cannot be created.
+    LRUTieredCache(size_type size, const std::string& path, std::uint64_t flash_bytes,
+                   std::size_t segment_bytes = std::size_t(1) << 22, LRUPolicy policy = LRUPolicy::strict)
+        : cache_(size, policy)
+        , fd_(-1)
+        , segment_bytes_(segment_bytes)
+        , segments_(segment_bytes ? flash_bytes / segment_bytes : 0)
+        , keys_(static_cast<std::size_t>(segments_))
+        , buffers_(static_cast<std::size_t>(segments_))
+        , head_(0)
+        , claims_(0)
+        , stopping_(false)
+        , flash_hits_(0)
+        , demotions_(0)
+        , flash_evictions_(0)
+        , io_errors_(0)
+    {
+        if (segment_bytes_ == 0 || segment_bytes_ > 0xFFFFFFFFu)
+            throw std::invalid_argument("LRUTieredCache: segment_bytes must be between 1 and 4 GB");
+        if (segments_ < max_pending + 2)
+            throw std::invalid_argument("LRUTieredCache: flash_bytes must hold at least max_pending + 2 segments");
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd_ < 0)
+            throw std::system_error(errno, std::generic_category(), "LRUTieredCache: open " + path);
+        ::unlink(path.c_str());
+        buffers_[0].reset(new segment_buffer(segment_bytes_));
+        cache_.set_eviction_listener([](TKey&&, TValue&&, LRUEvictionCause) {}, LRUEvictionMode::batched);
+        try{
+            writer_ = std::thread([this]() { write_segments(); });
+        }
+        catch (...){
+            ::close(fd_);
+            throw;
+        }
+    }
+
+    // Stops the writer (segments it has not written yet are dropped) and
+    // closes the file, which frees its space.
+    ~LRUTieredCache() {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            stopping_ = true;
+        }
+        work_.notify_one();
+        writer_.join();
+        ::close(fd_);
+    }
+
+    // Copies the value out on a hit in either tier; a flash hit moves the
+    // entry back to RAM. A record that cannot be read or decoded counts as
+    // a miss (and as an I/O error) and is forgotten.
+    bool get(const TKey& key, TValue& value) {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto pos = cache_.get(key);
+        if (pos != cache_.end()){
+            value = pos->second;
+            return true;
+        }
+        for (bool retry = false; ; retry = true){
+            auto found = index_.find(key);
+            if (found == index_.end()){
+                // promoted by another get() while this one read, or replaced:
+                // a hit in RAM after all, its miss there already counted
+                if (!retry || !cache_.promote(key))
+                    return false;
+                value = cache_.peek(key)->second;
+                return true;
+            }
+            if (found->second.segment & claimed)
+                return false;       // demoted, not on flash yet
+            location at = found->second;
+            std::shared_ptr<segment_buffer> buffer = buffers_[slot_of(at.segment)];       // null once written
+            lock.unlock();
+
+            std::vector<char> record;
+            const char* p;
+            if (buffer){
+                p = buffer->data.get() + at.offset;
+            }
+            else{
+                record.resize(at.length);
+                p = read_all(record.data(), at.length, file_offset(at)) ? record.data() : nullptr;
+            }
+            TKey stored_key;
+            TValue stored_value;
+            bool decoded = p && decode(p, at.length, stored_key, stored_value) && typename cache_type::key_equal()(stored_key, key);
+
+            lock.lock();
+            found = index_.find(key);
+            if (found == index_.end() || found->second.segment != at.segment || found->second.offset != at.offset)
+                continue;           // promoted (and maybe demoted again) meanwhile: look again
+            index_.erase(found);
+            if (!decoded){
+                ++io_errors_;
+                return false;
+            }
+            ++flash_hits_;
+            value = stored_value;
+            cache_.put(std::move(stored_key), std::move(stored_value));
+            demote(lock);
+            return true;
+        }
+    }
+
+    // Puts key in RAM, superseding any copy on flash, and demotes whatever
+    // that evicts. Returns what the RAM tier's put() does.
+    template<class K, class V = TValue>
+    bool put(K&& key, V&& value) {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto found = index_.find(key);
+        if (found != index_.end())
+            index_.erase(found);
+        bool kept = cache_.put(std::forward<K>(key), std::forward<V>(value));
+        demote(lock);
+        return kept;
+    }
+
+    // In either tier (or on its way to flash), without promoting anything.
+    bool is_cached(const TKey& key) const {
+        std::lock_guard<std::mutex> lock(lock_);
+        return cache_.is_cached(key) || index_.count(key) != 0;
+    }
+
+    inline size_type ram_size() const {
+        std::lock_guard<std::mutex> lock(lock_);
+        return cache_.size();
+    }
+
+    // Entries on flash (or on their way there).
+    inline size_type flash_size() const {
+        std::lock_guard<std::mutex> lock(lock_);
+        return index_.size();
+    }
+
+    inline std::uint64_t flash_capacity() const { return segments_ * segment_bytes_; }
+
+    // Hits the RAM tier missed, entries moved to flash, entries forgotten
+    // when their segment was reclaimed, and failed reads and writes.
+    inline unsigned long long flash_hits() const      { std::lock_guard<std::mutex> lock(lock_); return flash_hits_;      }
+    inline unsigned long long demotion_count() const  { std::lock_guard<std::mutex> lock(lock_); return demotions_;       }
+    inline unsigned long long flash_evictions() const { std::lock_guard<std::mutex> lock(lock_); return flash_evictions_; }
+    inline unsigned long long io_errors() const       { std::lock_guard<std::mutex> lock(lock_); return io_errors_;       }
+
+private:
+    LRUTieredCache(const LRUTieredCache&);
+    LRUTieredCache& operator=(const LRUTieredCache&);
+
+    inline std::size_t slot_of(std::uint64_t segment) const { return static_cast<std::size_t>(segment % segments_); }
+
+    inline off_t file_offset(const location& at) const {
+        return static_cast<off_t>(slot_of(at.segment) * segment_bytes_ + at.offset);
+    }
+
+    static bool decode(const char* p, std::size_t n, TKey& key, TValue& value) {
+        const char* end = p + n;
+        return lru_detail::read_field(p, end, key) && lru_detail::read_field(p, end, value) && p == end;
+    }
+
+    // Moves what the RAM tier evicted for room onto flash. The evictions
+    // and each record are the caller's own: make_room() may let other
+    // threads in, and those demote too. So each entry first claims its key
+    // in the index; a put() meanwhile drops the claim, a later demotion of
+    // the key takes it over, and either way this (older) value is dropped.
+    void demote(std::unique_lock<std::mutex>& lock) {
+        eviction_batch batch;
+        batch.swap(spare_batch());
+        cache_.take_evictions(batch);
+        std::uint64_t first = claims_, last = claims_;
+        try{
+            for (std::size_t i = 0; i < batch.size(); ++i)
+                if (LRUEvictionCause::expired != batch[i].cause){
+                    index_[batch[i].key].segment = claimed | (claims_ + 1);
+                    last = ++claims_;
+                }
+            std::vector<char>& record = spare_record();
+            std::uint64_t claim = first;
+            for (std::size_t i = 0; i < batch.size(); ++i)
+                if (LRUEvictionCause::expired != batch[i].cause)
+                    append(batch[i].key, batch[i].value, ++claim, record, lock);
+        }
+        catch (...){
+            for (std::size_t i = 0; i < batch.size(); ++i)      // claims never to be appended
+                unclaim(batch[i].key, first, last);
+            batch.clear();
+            batch.swap(spare_batch());
+            throw;
+        }
+        batch.clear();
+        batch.swap(spare_batch());
+    }
+
+    // Drops key's claim if one in (first, last] still holds it.
+    void unclaim(const TKey& key, std::uint64_t first, std::uint64_t last) {
+        auto found = index_.find(key);
+        if (found != index_.end() && (found->second.segment & claimed)){
+            std::uint64_t claim = found->second.segment & ~claimed;
+            if (claim > first && claim <= last)
+                index_.erase(found);
+        }
+    }
+
+    void append(const TKey& key, const TValue& value, std::uint64_t claim, std::vector<char>& record,
+                std::unique_lock<std::mutex>& lock) {
+        record.clear();
+        {
+            lru_detail::vector_streambuf buffer(record);
+            std::ostream out(&buffer);
+            lru_detail::write_field(out, key);
+            lru_detail::write_field(out, value);
+        }
+        if (record.size() > segment_bytes_){       // never fits: dropped, as if reclaimed
+            unclaim(key, claim - 1, claim);
+            ++flash_evictions_;
+            return;
+        }
+        make_room(record.size(), lock);
+        // Having waited, key may have been put() again (and even demoted
+        // again): only the demotion still holding the claim appends.
+        auto found = index_.find(key);
+        if (found == index_.end() || found->second.segment != (claimed | claim))
+            return;
+        segment_buffer& active = *buffers_[slot_of(head_)];
+        std::memcpy(active.data.get() + active.used, record.data(), record.size());
+        location at = { head_, static_cast<std::uint32_t>(active.used), static_cast<std::uint32_t>(record.size()) };
+        active.used += record.size();
+        found->second = at;
+        keys_[slot_of(head_)].push_back(key);
+        ++demotions_;
+    }
+
+    // Seals the segment being filled if n more bytes don't fit, once the
+    // writer has room in its queue, releasing the lock while it waits;
+    // other threads may seal it meanwhile.
+    void make_room(std::size_t n, std::unique_lock<std::mutex>& lock) {
+        for (;;){
+            if (buffers_[slot_of(head_)]->used + n <= segment_bytes_)
+                return;
+            if (pending_.size() < max_pending)
+                break;
+            written_.wait(lock);
+        }
+        pending_.push_back(head_);
+        work_.notify_one();
+        ++head_;
+        // The ring is at least max_pending + 2 long, so the segment this
+        // slot held is on the file by now.
+        if (head_ >= segments_)
+            forget(slot_of(head_), head_ - segments_, flash_evictions_);
+        buffers_[slot_of(head_)].reset(new segment_buffer(segment_bytes_));
+    }
+
+    // Per thread, so demotions reuse their storage instead of allocating
+    // per call.
+    static eviction_batch& spare_batch() {
+        static thread_local eviction_batch batch;
+        return batch;
+    }
+
+    static std::vector<char>& spare_record() {
+        static thread_local std::vector<char> record;
+        return record;
+    }
+
+    // Drops the index entries a slot holds for segment, counting them.
+    void forget(std::size_t slot, std::uint64_t segment, unsigned long long& count) {
+        for (const TKey& key : keys_[slot]){
+            auto found = index_.find(key);
+            if (found != index_.end() && found->second.segment == segment){
+                index_.erase(found);
+                ++count;
+            }
+        }
+        keys_[slot].clear();
+    }
+
+    // The writer thread: writes full segments in order, then lets their
+    // buffers go. A segment that fails to write is forgotten.
+    void write_segments() {
+        std::unique_lock<std::mutex> lock(lock_);
+        for (;;){
+            while (!stopping_ && pending_.empty())
+                work_.wait(lock);
+            if (stopping_)
+                return;
+            std::uint64_t segment = pending_.front();
+            std::shared_ptr<segment_buffer> buffer = buffers_[slot_of(segment)];
+            lock.unlock();
+            location at = { segment, 0, 0 };
+            bool ok = write_all(buffer->data.get(), buffer->used, file_offset(at));
+            lock.lock();
+            pending_.pop_front();
+            buffers_[slot_of(segment)].reset();
+            if (!ok){
+                unsigned long long lost = 0;
+                forget(slot_of(segment), segment, lost);
+                ++io_errors_;
+            }
+            written_.notify_all();
+        }
+    }
+
+    bool write_all(const char* data, std::size_t n, off_t offset) const {
+        while (n){
+            ssize_t w = ::pwrite(fd_, data, n, offset);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return false;
+            data += w;
+            n -= static_cast<std::size_t>(w);
+            offset += w;
+        }
+        return true;
+    }
+
+    bool read_all(char* data, std::size_t n, off_t offset) const {
+        while (n){
+            ssize_t r = ::pread(fd_, data, n, offset);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return false;
+            data += r;
+            n -= static_cast<std::size_t>(r);
+            offset += r;
+        }
+        return true;
+    }
+
+    mutable std::mutex                           lock_;
+    std::condition_variable                      work_;             // a segment is pending, or stopping_
+    std::condition_variable                      written_;          // the writer finished a segment
+    cache_type                                   cache_;
+    int                                          fd_;
+    std::size_t                                  segment_bytes_;
+    std::uint64_t                                segments_;
+    flash_index                                  index_;
+    std::vector< std::vector<TKey> >             keys_;             // per slot: keys appended to its segment
+    std::vector< std::shared_ptr<segment_buffer> > buffers_;        // per slot: its segment, until written
+    std::uint64_t                                head_;             // the segment being filled
+    std::uint64_t                                claims_;           // the last demotion's claim
+    std::deque<std::uint64_t>                    pending_;          // full segments, oldest first
+    bool                                         stopping_;
+    unsigned long long                           flash_hits_;
+    unsigned long long                           demotions_;
+    unsigned long long                           flash_evictions_;
+    unsigned long long                           io_errors_;
+    std::thread                                  writer_;
+};
+
+#endif // defined(__unix__) || defined(__APPLE__)
+
+#endif // LRUTIEREDCACHE_H
@@ -0,0 +1,187 @@
+// LRUTimerWheel.h:
+// Hierarchical timing wheel that reclaims LRUCache's expired entries
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// Four wheels of 64 buckets, each bucket of one wheel as wide as the whole
+// wheel below it: about 1ms, 67ms, 4.3s and 4.6min per bucket, so a timer up
+// to ~4.9h out sits in a bucket no wider than a 64th of its distance.
+// Advancing the time visits only the buckets it moves through; timers found
+// there fire if due or drop down a wheel otherwise, so each timer is touched
+// at most once per wheel. Timers further out than the top wheel go round it
+// until they are in range.
+//
+// Timers are nodes in one array linked into their bucket by index, so
+// cancelling or rescheduling one is O(1). Times are plain nanosecond counts;
+// the wheel never reads a clock itself.
+//
+#ifndef LRUTIMERWHEEL_H
+#define LRUTIMERWHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+template<class THandle>
+class LRUTimerWheel {
+public:
+    typedef std::uint32_t timer_id;     // 0 is never a timer
+
+    LRUTimerWheel() : now_(0), free_(0), live_(0) {
+        nodes_.resize(1);
+        for (std::size_t i = 0; i < buckets; ++i)
+            heads_[i] = 0;
+    }
+
+    inline bool        empty() const { return live_ == 0; }
+    inline std::size_t size() const  { return live_;      }
+
+    // What the timers take beyond the wheel object itself.
+    inline std::size_t heap_bytes() const { return nodes_.capacity() * sizeof(node); }
+
+    inline timer_id schedule(THandle handle, std::uint64_t expires) {
+        timer_id id = free_;
+        if (id)
+            free_ = nodes_[id].next;
+        else{
+            id = static_cast<timer_id>(nodes_.size());
+            nodes_.push_back(node());
+        }
+        nodes_[id].handle = handle;
+        nodes_[id].expires = expires;
+        link(id);
+        ++live_;
+        return id;
+    }
+
+    inline void reschedule(timer_id id, std::uint64_t expires) {
+        unlink(id);
+        nodes_[id].expires = expires;
+        link(id);
+    }
+
+    inline void cancel(timer_id id) {
+        unlink(id);
+        release(id);
+    }
+
+    inline std::uint64_t expires(timer_id id) const { return nodes_[id].expires; }
+
+    // For containers that move an entry rather than relink it.
+    inline void rehandle(timer_id id, THandle handle) { nodes_[id].handle = handle; }
+
+    // Moves the wheel on to now and calls expire(handle) for every timer due
+    // by then. A fired timer is already released when expire() runs.
+    template<class F>
+    void advance(std::uint64_t now, F expire) {
+        std::uint64_t prev = now_;
+        if (now <= prev)
+            return;
+        now_ = now;
+        if (empty())
+            return;
+        for (unsigned level = 0; level < levels; ++level){
+            std::uint64_t prev_ticks = prev >> shift(level);
+            std::uint64_t ticks = now >> shift(level);
+            if (ticks <= prev_ticks)
+                break;
+            // from the bucket it was in to the one it is in now: the timers
+            // in that one are all within its width, so they drop down a wheel
+            std::uint64_t passed = ticks - prev_ticks;
+            unsigned n = passed >= slots ? slots : static_cast<unsigned>(passed) + 1;
+            for (unsigned i = 0; i < n; ++i)
+                expire_bucket(level * slots + ((prev_ticks + i) & (slots - 1)), expire);
+        }
+    }
+
+    void clear() {
+        nodes_.resize(1);
+        for (std::size_t i = 0; i < buckets; ++i)
+            heads_[i] = 0;
+        free_ = 0;
+        live_ = 0;
+    }
+
+private:
+    static const unsigned levels = 4;
+    static const unsigned slots = 64;       // per wheel, a power of two
+    static const std::size_t buckets = levels * slots;
+
+    // bucket width of each wheel: 2^20ns on the bottom one, x64 per wheel up
+    static inline unsigned shift(unsigned level) { return 20 + 6 * level; }
+
+    struct node {
+        node() : handle(), expires(0), prev(0), next(0), bucket(0) {}
+        THandle       handle;
+        std::uint64_t expires;
+        timer_id      prev;             // 0: first in its bucket
+        timer_id      next;
+        std::uint16_t bucket;
+    };
+
+    inline std::size_t bucket_for(std::uint64_t expires) const {
+        std::uint64_t delta = expires > now_ ? expires - now_ : 0;
+        unsigned level = 0;
+        while (level + 1 < levels && (delta >> shift(level)) >= slots)
+            ++level;
+        return level * slots + ((expires >> shift(level)) & (slots - 1));
+    }
+
+    inline void link(timer_id id) {
+        node& n = nodes_[id];
+        n.bucket = static_cast<std::uint16_t>(bucket_for(n.expires));
+        n.prev = 0;
+        n.next = heads_[n.bucket];
+        if (n.next)
+            nodes_[n.next].prev = id;
+        heads_[n.bucket] = id;
+    }
+
+    inline void unlink(timer_id id) {
+        node& n = nodes_[id];
+        if (n.prev)
+            nodes_[n.prev].next = n.next;
+        else
+            heads_[n.bucket] = n.next;
+        if (n.next)
+            nodes_[n.next].prev = n.prev;
+    }
+
+    inline void release(timer_id id) {
+        nodes_[id].next = free_;
+        free_ = id;
+        --live_;
+    }
+
+    template<class F>
+    void expire_bucket(std::size_t bucket, F& expire) {
+        timer_id id = heads_[bucket];
+        heads_[bucket] = 0;
+        while (id){
+            timer_id next = nodes_[id].next;
+            if (nodes_[id].expires <= now_){
+                THandle handle = nodes_[id].handle;
+                release(id);
+                expire(handle);
+            }
+            else{
+                link(id);               // not due yet: down to a finer wheel
+            }
+            id = next;
+        }
+    }
+
+    std::vector<node> nodes_;           // nodes_[0] unused, so 0 can mean none
+    timer_id          heads_[buckets];
+    std::uint64_t     now_;
+    timer_id          free_;
+    std::size_t       live_;
+};
+
+#endif // LRUTIMERWHEEL_H
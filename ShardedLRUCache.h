@@ -0,0 +1,805 @@
+// ShardedLRUCache.h:
+// A thread-safe front-end that spreads keys over independent LRUCache shards
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// Each key is hashed onto one of N shards, and each shard is an ordinary
+// LRUCache behind its own lock, so threads only contend when they hit the
+// same shard. Recency is tracked per shard: the cache as a whole evicts an
+// approximation of the globally least recently used entry.
+//
+// Iterators into a shard would not survive its lock being released, so
+// lookups copy the value out instead of returning a const_iterator.
+//
+// With LRUPolicy::clock a hit doesn't modify the shard, so get() only takes the
+// shard lock shared (where the standard library has a shared mutex, i.e.
+// C++14 on); misses, inserts and updates still serialize per shard. Those
+// shared-lock hits are counted in the shard when its stats policy is
+// LRUStripedStats (see LRUStats.h), and in a pair of per-shard atomics
+// otherwise.
+//
+// With LRUPromotionMode::buffered the other policies get the same shared-lock
+// hits, BP-Wrapper style: a hit only records its key in one of the shard's
+// per-thread-stripe buffers, and the buffered hits are replayed in a batch
+// under the exclusive lock once a buffer fills - by the first reader to
+// find the lock free after that, or else by the next writer. Each buffer is
+// a ring of the latest promotion_batch hits, the oldest overwritten first,
+// and its key slots are assigned into rather than reallocated. Recency then
+// lags by about promotion_batch hits per stripe; a hit that finds its
+// stripe busy is dropped, as Caffeine drops them.
+//
+// Where the shards can be read while a writer changes them - LRUSlab with
+// LRUSlabIndex, unit weights, trivially copyable keys and values (see
+// LRUCache::racing_peeks()) - peek() and is_cached() take no lock at all.
+// Each shard keeps a version counter that writers make odd while they hold
+// the lock, i.e. a seqlock: a reader copies the value out, checks the
+// version didn't move, and retries if it did, falling back to the shared
+// lock after a few collisions (or for entries with a TTL). Readers therefore
+// stop contending with writers, and with each other. This relies on the
+// shards' memory staying put, so the shard indexes are reserved up front,
+// and a resize() that grows the cache beyond that turns the lock-free path
+// off for good.
+//
+// for_each_chunk() and copy_to() export a consistent snapshot without
+// holding up writers for the length of the scan. Starting one opens a new
+// epoch, locking every shard together just long enough to mark it; then
+// each shard is copied the first time either the scan or a write reaches
+// it, so what the scan sees is the whole cache as of the moment the epoch
+// opened. A write costs at most one copy of its shard per snapshot.
+//
+#ifndef SHARDEDLRUCACHE_H
+#define SHARDEDLRUCACHE_H
+
+#include "LRUCache.h"
+
+#include <array>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#if __cplusplus >= 201402L
+#include <shared_mutex>
+#endif
+
+namespace lru_detail {
+#if __cplusplus >= 201703L
+    typedef std::shared_mutex shard_mutex;
+    template<class M> using shared_lock = std::shared_lock<M>;
+#elif __cplusplus >= 201402L
+    typedef std::shared_timed_mutex shard_mutex;
+    template<class M> using shared_lock = std::shared_lock<M>;
+#else
+    typedef std::mutex shard_mutex;     // no shared locking before C++14
+    template<class M> using shared_lock = std::lock_guard<M>;
+#endif
+
+    // Stores key in slot, reusing the slot's storage where TKey can be
+    // assigned from K directly (e.g. a std::string from a const char*).
+    template<class T, class K>
+    inline auto assign_key(T& slot, const K& key, int) -> decltype(void(slot = key)) { slot = key; }
+
+    template<class T, class K>
+    inline void assign_key(T& slot, const K& key, long) { slot = T(key); }
+}
+
+// How ShardedLRUCache::get() applies hits under the policies where a hit
+// changes the shard (all but LRUPolicy::clock): at once, under the shard's
+// exclusive lock, or buffered and replayed in batches (see above).
+enum class LRUPromotionMode { immediate, buffered };
+
+template<class TKey, class TValue, std::size_t N = 16, class TCache = LRUCache<TKey, TValue> >
+class ShardedLRUCache {
+    static_assert(N > 0, "ShardedLRUCache needs at least one shard");
+
+public:
+    typedef TCache                                         cache_type;
+    typedef typename cache_type::size_type                 size_type;
+    typedef typename cache_type::value_type                value_type;
+    typedef typename cache_type::eviction_listener         eviction_listener;
+    typedef typename cache_type::eviction_batch            eviction_batch;
+    typedef typename cache_type::snapshot_writer           snapshot_writer;
+    typedef typename cache_type::snapshot_reader           snapshot_reader;
+
+    // size is the total capacity, split evenly (rounding up) over the shards.
+    ShardedLRUCache(size_type size, LRUPolicy policy = LRUPolicy::strict)
+        : batched_(false), buffered_(false), epoch_(0), reserved_((size + N - 1) / N), racing_(racing)
+    {
+        for (std::size_t i = 0; i < N; ++i){
+            if (racing)
+                shards_[i].reset(new shard(reserved_, policy, LRUReserveIndex()));
+            else
+                shards_[i].reset(new shard(reserved_, policy));
+        }
+    }
+
+    // Copies the value out on a hit (promoting the entry within its shard).
+    // Like the shards' own lookups, get(), peek() and is_cached() take any
+    // key type the cache's transparent hasher accepts.
+    template<class K>
+    bool get(const K& key, TValue& value) {
+        shard& s = shard_for(key);
+        bool clock = LRUPolicy::clock == s.cache.policy();
+        if (clock || buffered_){
+            {
+                lru_detail::shared_lock<lru_detail::shard_mutex> lock(s.lock);
+                auto pos = s.cache.get_shared(key);
+                if (pos == s.cache.end()){
+                    if (shared_counts)
+                        s.shared_misses.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                if (shared_counts)
+                    s.shared_hits.fetch_add(1, std::memory_order_relaxed);
+                value = pos->second;
+            }
+            if (!clock)
+                buffer_hit(s, key);
+            return true;
+        }
+        write_lock lock(*this, s);
+        auto pos = s.cache.get(key);
+        if (pos == s.cache.end())
+            return false;
+        value = pos->second;
+        return true;
+    }
+
+    // Returns key's value, loading it with loader(key) on a miss. The loader
+    // runs outside any lock, and misses on a key that is already being loaded
+    // don't load it again: they wait for the first loader and return its
+    // value (or rethrow its exception), so a cold key costs one load however
+    // many threads ask for it at once. The value is put() once loaded, with
+    // the cache's default TTL. loader must not itself ask for the same key.
+    template<class F>
+    TValue get_or_compute(const TKey& key, F loader) {
+        shard& s = shard_for(key);
+        std::shared_ptr<flight> f;
+        bool leader = false;
+        {
+            write_lock lock(*this, s);
+            auto pos = s.cache.get(key);
+            if (pos != s.cache.end())
+                return pos->second;
+            auto found = s.flights.find(key);
+            if (found != s.flights.end()){
+                f = found->second;
+            }
+            else{
+                f = std::make_shared<flight>();
+                s.flights.emplace(key, f);
+                leader = true;
+            }
+        }
+        if (!leader)
+            return f->wait();
+        try{
+            TValue value(loader(key));
+            {
+                write_lock lock(*this, s);
+                s.cache.put(key, value);
+                land(s, key, f);
+            }
+            if (f.use_count() > 1)          // landed, so nobody new can start waiting
+                f->finish(&value, std::exception_ptr());
+            return value;
+        }
+        catch (...){
+            {
+                write_lock lock(*this, s);
+                land(s, key, f);
+            }
+            f->finish(nullptr, std::current_exception());
+            throw;
+        }
+    }
+
+    template<class K>
+    bool peek(const K& key, TValue& value) const {
+        shard& s = shard_for(key);
+        int found = peek_racing(s, key, &value);
+        if (found >= 0)
+            return found != 0;
+        lru_detail::shared_lock<lru_detail::shard_mutex> lock(s.lock);
+        auto pos = s.cache.peek(key);
+        if (pos == s.cache.end())
+            return false;
+        value = pos->second;
+        return true;
+    }
+
+    template<class K, class V = TValue>
+    bool put(K&& key, V&& value) {
+        shard& s = shard_for(key);
+        write_lock lock(*this, s);
+        return s.cache.put(std::forward<K>(key), std::forward<V>(value));
+    }
+
+    template<class K, class V = TValue, class Rep, class Period>
+    bool put(K&& key, V&& value, std::chrono::duration<Rep, Period> ttl) {
+        shard& s = shard_for(key);
+        write_lock lock(*this, s);
+        return s.cache.put(std::forward<K>(key), std::forward<V>(value), ttl);
+    }
+
+    template<class K, class... Args>
+    bool emplace(K&& key, Args&&... args) {
+        shard& s = shard_for(key);
+        write_lock lock(*this, s);
+        return s.cache.emplace(std::forward<K>(key), std::forward<Args>(args)...).second;
+    }
+
+    template<class K, class... Args>
+    bool try_emplace(K&& key, Args&&... args) {
+        shard& s = shard_for(key);
+        write_lock lock(*this, s);
+        return s.cache.try_emplace(std::forward<K>(key), std::forward<Args>(args)...).second;
+    }
+
+    template<class K>
+    bool is_cached(const K& key) const {
+        shard& s = shard_for(key);
+        int found = peek_racing(s, key, nullptr);
+        if (found >= 0)
+            return found != 0;
+        lru_detail::shared_lock<lru_detail::shard_mutex> lock(s.lock);
+        return s.cache.is_cached(key);
+    }
+
+    // Resizes every shard to its share of size; see LRUCache::resize().
+    void resize(size_type size, size_type max_evictions = size_type(-1)) {
+        size_type per_shard = (size + N - 1) / N;
+        if (per_shard > reserved_)
+            stop_racing();
+        for (std::size_t i = 0; i < N; ++i){
+            write_lock lock(*this, *shards_[i]);
+            shards_[i]->cache.resize(per_shard, max_evictions);
+        }
+    }
+
+    // See LRUCache::save(). The snapshot holds the shards one after another,
+    // each locked only while it is written; recency order is kept within
+    // each shard, which is all a shard's load needs.
+    void save(const std::string& path) const {
+        snapshot_writer writer(path);
+        for (std::size_t i = 0; i < N; ++i){
+            lru_detail::shared_lock<lru_detail::shard_mutex> lock(shards_[i]->lock);
+            shards_[i]->cache.save(writer);
+        }
+        writer.commit();
+    }
+
+    // See LRUCache::for_each_chunk(), but over a snapshot of the whole cache
+    // (see above), with fn called outside every lock, so fn may use the
+    // cache. The shards come one after another, each in its own order.
+    // Snapshots are taken one at a time.
+    template<class F>
+    void for_each_chunk(F fn) const {
+        std::lock_guard<std::mutex> one_at_a_time(snapshot_lock_);
+        std::uint64_t epoch = ++epoch_;
+        lock_all();
+        for (std::size_t i = 0; i < N; ++i){
+            shards_[i]->snapshot_epoch = epoch;
+            shards_[i]->lock.unlock();
+        }
+        std::size_t i = 0;
+        try{
+            for (; i < N; ++i){
+                std::unique_ptr< std::vector<value_type> > entries;
+                {
+                    std::lock_guard<lru_detail::shard_mutex> lock(shards_[i]->lock);
+                    freeze(*shards_[i]);
+                    entries.swap(shards_[i]->frozen);
+                }
+                lru_detail::entry_chunker<value_type, F> chunks(fn);
+                for (std::size_t e = 0; e < entries->size(); ++e)
+                    chunks.add((*entries)[e]);
+                chunks.flush();
+            }
+        }
+        catch (...){
+            // close the epoch for the shards not reached, so writers stop copying them
+            for (; i < N; ++i){
+                std::lock_guard<lru_detail::shard_mutex> lock(shards_[i]->lock);
+                shards_[i]->frozen_epoch = epoch;
+                shards_[i]->frozen.reset();
+            }
+            throw;
+        }
+    }
+
+    template<class OutputIt>
+    size_type copy_to(OutputIt out) const {
+        size_type n = 0;
+        for_each_chunk([&out, &n](const LRUEntryChunk<value_type>& chunk) {
+            out = std::copy(chunk.begin(), chunk.end(), out);
+            n += chunk.size();
+        });
+        return n;
+    }
+
+    size_type load(const std::string& path) {
+        snapshot_reader reader(path);
+        size_type n = 0;
+        while (!reader.done())
+            n += load_some(reader, 4096);
+        return n;
+    }
+
+    // See LRUCache::load_some(): reads up to max_entries more entries and
+    // restores each into its shard, taking the shard's lock per entry, so
+    // the cache serves as usual while warming up. A full shard makes no room
+    // for its entries; entries for the other shards still go in. Returns
+    // how many were added.
+    size_type load_some(snapshot_reader& reader, size_type max_entries = size_type(-1)) {
+        size_type n = 0;
+        TKey key;
+        TValue value;
+        for (size_type i = 0; i < max_entries && reader.next(key, value); ++i){
+            shard& s = shard_for(key);
+            write_lock lock(*this, s);
+            n += s.cache.restore(std::move(key), std::move(value));
+        }
+        return n;
+    }
+
+    template<class Rep, class Period>
+    void set_default_ttl(std::chrono::duration<Rep, Period> ttl) {
+        for (std::size_t i = 0; i < N; ++i){
+            std::lock_guard<lru_detail::shard_mutex> lock(shards_[i]->lock);
+            shards_[i]->cache.set_default_ttl(ttl);
+        }
+    }
+
+    // Reclaims expired entries in every shard; see LRUCache::expire().
+    size_type expire() {
+        size_type n = 0;
+        for (std::size_t i = 0; i < N; ++i){
+            write_lock lock(*this, *shards_[i]);
+            n += shards_[i]->cache.expire();
+        }
+        return n;
+    }
+
+    // See LRUCache::set_eviction_listener(). In batched mode the shards
+    // buffer their evictions and each call hands over what it evicted once it
+    // has released the shard's lock, so the listener is free to block - and
+    // runs on the thread that caused the evictions. Set it before the cache
+    // is shared between threads.
+    void set_eviction_listener(eviction_listener listener, LRUEvictionMode mode = LRUEvictionMode::sync) {
+        for (std::size_t i = 0; i < N; ++i){
+            write_lock lock(*this, *shards_[i]);        // delivers anything pending first
+            shards_[i]->cache.set_eviction_listener(listener, mode);
+        }
+        listener_ = std::move(listener);
+        batched_ = LRUEvictionMode::batched == mode && listener_;
+    }
+
+    // See LRUPromotionMode. Set it before the cache is shared between threads.
+    void set_promotion_mode(LRUPromotionMode mode) {
+        for (std::size_t i = 0; i < N; ++i){
+            shards_[i]->promotions_due.store(true, std::memory_order_relaxed);
+            write_lock lock(*this, *shards_[i]);        // replays anything buffered first
+        }
+        buffered_ = LRUPromotionMode::buffered == mode;
+    }
+
+    void clear() {
+        for (std::size_t i = 0; i < N; ++i){
+            write_lock lock(*this, *shards_[i]);
+            shards_[i]->cache.clear();
+        }
+    }
+
+    // The aggregates below visit the shards one at a time, so under
+    // concurrent writes they are a sum of per-shard snapshots, not a global one.
+    // They hold each shard's lock shared, so monitoring doesn't stall readers.
+    size_type size() const     { return sum(&cache_type::size);     }
+    size_type max_size() const { return sum(&cache_type::max_size); }
+    size_type weight() const   { return sum(&cache_type::weight);   }
+    bool      empty() const    { return size() == 0;                }
+
+    unsigned long long cache_hits()   const { return sum(&cache_type::cache_hits) + sum(&shard::shared_hits);     }
+    unsigned long long cache_misses() const { return sum(&cache_type::cache_misses) + sum(&shard::shared_misses); }
+    unsigned long long update_count() const { return sum(&cache_type::update_count); }
+    unsigned long long bounce_count() const { return sum(&cache_type::bounce_count); }
+    unsigned long long expired_count() const { return sum(&cache_type::expired_count); }
+
+    LRUStatsSnapshot stats() const {
+        LRUStatsSnapshot total;
+        for (std::size_t i = 0; i < N; ++i){
+            lru_detail::shared_lock<lru_detail::shard_mutex> lock(shards_[i]->lock);
+            total += shards_[i]->cache.stats();
+        }
+        total.hits += sum(&shard::shared_hits);
+        total.misses += sum(&shard::shared_misses);
+        return total;
+    }
+
+    // Resets every shard's stats; see LRUCache::reset_stats().
+    LRUStatsSnapshot reset_stats() {
+        LRUStatsSnapshot total;
+        for (std::size_t i = 0; i < N; ++i){
+            std::lock_guard<lru_detail::shard_mutex> lock(shards_[i]->lock);
+            total += shards_[i]->cache.reset_stats();
+            total.hits += shards_[i]->shared_hits.exchange(0, std::memory_order_relaxed);
+            total.misses += shards_[i]->shared_misses.exchange(0, std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // Every shard's LRUCache::memory_usage(), plus the shards' own locks,
+    // counters and padding.
+    LRUMemoryUsage memory_usage() const {
+        return total_usage([](const cache_type& c) { return c.memory_usage(); });
+    }
+
+    template<class F>
+    LRUMemoryUsage memory_usage(F sizer) const {
+        return total_usage([&sizer](const cache_type& c) { return c.memory_usage(sizer); });
+    }
+
+    static inline std::size_t shard_count() { return N; }
+
+    template<class K>
+    inline std::size_t shard_index(const K& key) const {
+        // Fibonacci-hash the key's hash so the shard choice uses different
+        // bits than the shard's own bucket/slot selection does.
+        std::uint64_t h = static_cast<std::uint64_t>(typename cache_type::hasher()(key)) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<std::size_t>(h >> 32) % N;
+    }
+
+private:
+    typedef typename cache_type::stats_type stats_type;
+
+    // A get_or_compute() load in progress, waited on by the other misses
+    // on its key.
+    struct flight {
+        flight() : done(false) {}
+
+        TValue wait() {
+            std::unique_lock<std::mutex> hold(lock);
+            landed.wait(hold, [this]{ return done; });
+            if (error)
+                std::rethrow_exception(error);
+            return *value;
+        }
+
+        void finish(const TValue* loaded, std::exception_ptr failed) {
+            {
+                std::lock_guard<std::mutex> hold(lock);
+                if (loaded)
+                    value.reset(new TValue(*loaded));
+                error = failed;
+                done = true;
+            }
+            landed.notify_all();
+        }
+
+        std::mutex              lock;
+        std::condition_variable landed;
+        bool                    done;
+        std::unique_ptr<TValue> value;
+        std::exception_ptr      error;
+    };
+
+    typedef std::unordered_map<TKey, std::shared_ptr<flight>,
+                               typename cache_type::hasher, typename cache_type::key_equal> flight_map;
+
+    // Whether get() under a shared lock has to count its own hits and misses:
+    // only if the shard counts at all, but not safely from several threads.
+    static const bool shared_counts = stats_type::enabled && !stats_type::concurrent;
+
+    // Whether peek() and is_cached() can read the shards without a lock,
+    // and how often they try before taking it.
+    static const bool     racing = cache_type::racing_peeks();
+    static const unsigned racing_attempts = 4;
+    static const std::size_t reader_stripes = 16;
+
+    // Buffered hits per stripe before they are replayed, and stripes per shard.
+    static const std::size_t promotion_batch = 32;
+    static const std::size_t promotion_stripes = 8;
+
+    struct promotion_stripe {
+        promotion_stripe() : keys(promotion_batch), count(0), next(0) {}
+
+        std::mutex        lock;
+        std::vector<TKey> keys;         // a ring of promotion_batch slots
+        std::size_t       count;        // hits in it, up to promotion_batch
+        std::size_t       next;         // the slot the next hit goes in
+        char              padding[lru_detail::cache_line_size];
+    };
+
+    // Optimistic readers in flight, striped by thread, so that resize() can
+    // wait them out before the shards' memory moves.
+    struct reader_stripe {
+        reader_stripe() : count(0) {}
+        std::atomic<unsigned> count;
+        char                  padding[lru_detail::cache_line_size - sizeof(std::atomic<unsigned>)];
+    };
+
+    // Allocated one by one, so the trailing padding is enough to keep the
+    // next shard's lock off the cache lines this one writes to.
+    struct shard {
+        template<class... Reserve>
+        shard(size_type size, LRUPolicy policy, Reserve... reserve)
+            : cache(size, reserve..., policy), shared_hits(0), shared_misses(0), version(0)
+            , promotions_due(false), snapshot_epoch(0), frozen_epoch(0) {}
+
+        lru_detail::shard_mutex lock;
+        cache_type              cache;
+        // get() under a shared lock, unless the cache counts those itself
+        std::atomic<unsigned long long> shared_hits;
+        std::atomic<unsigned long long> shared_misses;
+        flight_map              flights;        // get_or_compute() loads in progress
+        std::atomic<std::uint64_t> version;     // odd while a writer holds the lock (racing only)
+        // LRUPromotionMode::buffered: hits waiting to be replayed, and
+        // whether a stripe has filled up since they last were
+        promotion_stripe         promotions[promotion_stripes];
+        std::atomic<bool>        promotions_due;
+        // for_each_chunk(): frozen holds the shard's entries as of snapshot
+        // frozen_epoch, until the scan takes them; the shard still has to
+        // be copied while frozen_epoch is behind snapshot_epoch.
+        std::uint64_t           snapshot_epoch;
+        std::uint64_t           frozen_epoch;
+        std::unique_ptr< std::vector<value_type> > frozen;
+        char                    padding[lru_detail::cache_line_size];
+    };
+
+    template<class K>
+    inline shard& shard_for(const K& key) const { return *shards_[shard_index(key)]; }
+
+    // Records a hit for replay, over the stripe's oldest once it is full.
+    // A full stripe flags the shard, and from then on every hit tries the
+    // shard's lock, to replay the lot itself, until one gets it or a writer
+    // replays them first.
+    template<class K>
+    void buffer_hit(shard& s, const K& key) {
+        promotion_stripe& b = s.promotions[lru_detail::thread_stripe() % promotion_stripes];
+        {
+            std::unique_lock<std::mutex> hold(b.lock, std::try_to_lock);
+            if (!hold.owns_lock())
+                return;
+            lru_detail::assign_key(b.keys[b.next], key, 0);
+            b.next = (b.next + 1) % promotion_batch;
+            if (b.count < promotion_batch && ++b.count == promotion_batch)
+                s.promotions_due.store(true, std::memory_order_relaxed);
+        }
+        if (s.promotions_due.load(std::memory_order_relaxed) && s.lock.try_lock())
+            write_lock lock(*this, s, std::adopt_lock);         // replays on the way in
+    }
+
+    // Replays the buffered hits of every stripe not busy right now. Call
+    // with s locked exclusively.
+    static void replay_hits(shard& s) {
+        s.promotions_due.store(false, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < promotion_stripes; ++i){
+            promotion_stripe& b = s.promotions[i];
+            std::unique_lock<std::mutex> hold(b.lock, std::try_to_lock);
+            if (!hold.owns_lock()){
+                s.promotions_due.store(true, std::memory_order_relaxed);
+                continue;
+            }
+            // oldest first; the keys stay, for the next hits to assign into
+            for (std::size_t k = promotion_batch - b.count; k < promotion_batch; ++k)
+                s.cache.promote(b.keys[(b.next + k) % promotion_batch]);
+            b.count = 0;
+        }
+    }
+
+    // The seqlock read behind peek() and is_cached(): 1 or 0 for a hit or a
+    // miss (the value copied to value, if given), or -1 if the caller has to
+    // take the lock after all.
+    template<class K>
+    int peek_racing(shard& s, const K& key, TValue* value) const {
+        return peek_racing(s, key, value, std::integral_constant<bool, racing>());
+    }
+
+    template<class K>
+    int peek_racing(shard&, const K&, TValue*, std::false_type) const { return -1; }
+
+    template<class K>
+    int peek_racing(shard& s, const K& key, TValue* value, std::true_type) const {
+        reader_stripe& mine = readers_[lru_detail::thread_stripe() % reader_stripes];
+        mine.count.fetch_add(1, std::memory_order_seq_cst);
+        int found = -1;
+        if (racing_.load(std::memory_order_seq_cst)){
+            alignas(TValue) unsigned char copy[sizeof(TValue)];
+            for (unsigned attempt = 0; attempt < racing_attempts; ++attempt){
+                std::uint64_t before = s.version.load(std::memory_order_acquire);
+                if (before & 1)
+                    continue;           // a writer is in
+                int result = s.cache.peek_racing(key, copy);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (s.version.load(std::memory_order_relaxed) != before)
+                    continue;
+                if (result > 0 && value)
+                    std::memcpy(value, copy, sizeof(TValue));
+                found = result;
+                break;
+            }
+        }
+        mine.count.fetch_sub(1, std::memory_order_release);
+        return found;
+    }
+
+    // Turns the lock-free peek() off and waits for the readers already in it.
+    void stop_racing() {
+        if (!racing_.exchange(false, std::memory_order_seq_cst))
+            return;
+        for (std::size_t i = 0; i < reader_stripes; ++i)
+            while (readers_[i].count.load(std::memory_order_acquire) != 0)
+                std::this_thread::yield();
+    }
+
+    // Copies s aside for the snapshot in progress, if it hasn't been yet.
+    // Call with s locked exclusively, before changing anything in it.
+    static void freeze(shard& s) {
+        if (s.frozen_epoch == s.snapshot_epoch)
+            return;
+        std::unique_ptr< std::vector<value_type> > entries(new std::vector<value_type>());
+        entries->reserve(s.cache.size());
+        s.cache.copy_to(std::back_inserter(*entries));
+        s.frozen.swap(entries);
+        s.frozen_epoch = s.snapshot_epoch;
+    }
+
+    // Locks every shard exclusively. A sync eviction listener may write to
+    // one shard while holding another's lock, so this never waits for one
+    // lock while holding others: it backs off and starts again from the
+    // lock that was taken.
+    void lock_all() const {
+        std::size_t first = 0;
+        for (;;){
+            shards_[first]->lock.lock();
+            std::size_t busy = N;
+            for (std::size_t i = 0; i < N && busy == N; ++i)
+                if (i != first && !shards_[i]->lock.try_lock())
+                    busy = i;
+            if (busy == N)
+                return;
+            for (std::size_t i = 0; i < busy; ++i)
+                if (i != first)
+                    shards_[i]->lock.unlock();
+            shards_[first]->lock.unlock();
+            first = busy;
+            std::this_thread::yield();
+        }
+    }
+
+    template<class F>
+    LRUMemoryUsage total_usage(F usage) const {
+        LRUMemoryUsage total;
+        total.other_bytes = sizeof(*this);
+        for (std::size_t i = 0; i < N; ++i){
+            lru_detail::shared_lock<lru_detail::shard_mutex> lock(shards_[i]->lock);
+            total += usage(shards_[i]->cache);
+            total.other_bytes += sizeof(shard) - sizeof(cache_type);
+        }
+        return total;
+    }
+
+    // Ends f's flight, unless a later one has taken its place already. Call
+    // with the shard locked.
+    template<class K>
+    static void land(shard& s, const K& key, const std::shared_ptr<flight>& f) {
+        auto found = s.flights.find(key);
+        if (found != s.flights.end() && found->second == f)
+            s.flights.erase(found);
+    }
+
+    // Holds a shard's lock exclusively, like a lock_guard; in batched mode it
+    // collects what the shard evicted meanwhile before releasing it, and
+    // delivers that afterwards.
+    class write_lock {
+    public:
+        write_lock(const ShardedLRUCache& owner, shard& s) : owner_(owner), shard_(s) {
+            s.lock.lock();
+            enter();
+        }
+
+        // Takes over a lock already held (try_lock()ed).
+        write_lock(const ShardedLRUCache& owner, shard& s, std::adopt_lock_t) : owner_(owner), shard_(s) {
+            enter();
+        }
+
+        ~write_lock() {
+            if (racing)
+                shard_.version.store(shard_.version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            if (!owner_.batched_){
+                shard_.lock.unlock();
+                return;
+            }
+            eviction_batch& batch = spare_batch();
+            shard_.cache.take_evictions(batch);
+            shard_.lock.unlock();
+            owner_.deliver(batch);
+        }
+
+    private:
+        write_lock(const write_lock&);
+        write_lock& operator=(const write_lock&);
+
+        void enter() {
+            try{
+                freeze(shard_);
+            }
+            catch (...){
+                shard_.lock.unlock();
+                throw;
+            }
+            if (racing){
+                shard_.version.store(shard_.version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+            }
+            if (shard_.promotions_due.load(std::memory_order_relaxed))
+                replay_hits(shard_);
+        }
+
+        const ShardedLRUCache& owner_;
+        shard&                 shard_;
+    };
+
+    // Per thread, so batches pass their storage back and forth with the
+    // shards' buffers instead of being allocated per call.
+    static eviction_batch& spare_batch() {
+        static thread_local eviction_batch batch;
+        return batch;
+    }
+
+    void deliver(eviction_batch& batch) const {
+        if (batch.empty())
+            return;
+        eviction_batch local;
+        local.swap(batch);      // a listener writing back to this cache needs batch
+        for (std::size_t i = 0; i < local.size(); ++i)
+            listener_(std::move(local[i].key), std::move(local[i].value), local[i].cause);
+        local.clear();
+        if (batch.empty())
+            batch.swap(local);
+    }
+
+    template<class R>
+    R sum(R (cache_type::*stat)() const) const {
+        R total = 0;
+        for (std::size_t i = 0; i < N; ++i){
+            lru_detail::shared_lock<lru_detail::shard_mutex> lock(shards_[i]->lock);
+            total += (shards_[i]->cache.*stat)();
+        }
+        return total;
+    }
+
+    unsigned long long sum(std::atomic<unsigned long long> shard::*counter) const {
+        unsigned long long total = 0;
+        for (std::size_t i = 0; i < N; ++i)
+            total += (shards_[i].get()->*counter).load(std::memory_order_relaxed);
+        return total;
+    }
+
+    std::array<std::unique_ptr<shard>, N> shards_;
+    eviction_listener                     listener_;    // batched mode; the shards keep their own copies
+    bool                                  batched_;
+    bool                                  buffered_;        // LRUPromotionMode::buffered
+    mutable std::mutex                    snapshot_lock_;   // for_each_chunk(): one snapshot at a time
+    mutable std::uint64_t                 epoch_;           // the latest snapshot's, under snapshot_lock_
+    size_type                             reserved_;        // per shard, by the constructor
+    std::atomic<bool>                     racing_;          // peek() may still read without a lock
+    mutable reader_stripe                 readers_[reader_stripes];
+};
+
+#endif // SHARDEDLRUCACHE_H
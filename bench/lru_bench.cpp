@@ -0,0 +1,323 @@
+// lru_bench.cpp:
+// Google Benchmark suite for LRUCache and ShardedLRUCache
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// Each benchmark fills a cache to capacity and then times one operation:
+//
+//   get_hit      get() of cached keys
+//   get_miss     get() of keys never put
+//   peek         peek() of cached keys
+//   put_update   put() of cached keys
+//   put_evict    put() of new keys into the full cache, each evicting one
+//   replay       get(), and put() on a miss, over twice as many keys as fit:
+//                what the cache's hit ratio comes to under the workload
+//
+// with the keys drawn from the workloads of workloads.h, for LRUCache and
+// for a 16-shard ShardedLRUCache (1 and 4 threads), 64-bit and 24-character
+// string keys, and 8-byte and 100-byte values. Besides Google Benchmark's
+// time and items_per_second (ops/s) it reports
+//
+//   p50_ns, p99_ns   latency percentiles, from timing every 16th call
+//   hit_ratio        cache_hits() / (cache_hits() + cache_misses()) of the run,
+//                    for the benchmarks that call get()
+//   bytes_per_entry  heap bytes the filled cache holds, per entry
+//
+// Build and run, e.g. only the sharded get() hits:
+//
+//     g++ -std=c++14 -O2 -I.. lru_bench.cpp -o lru_bench -lbenchmark -lpthread
+//     ./lru_bench --benchmark_filter='sharded.*get_hit'
+//
+#include "ShardedLRUCache.h"
+#include "workloads.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+// Every allocation is counted, so a cache's footprint is the difference
+// between the live heap bytes before and after filling it.
+namespace {
+    std::atomic<std::size_t> live_bytes(0);
+
+    const std::size_t header = 16;          // keeps the caller's block 16-byte aligned
+}
+
+void* operator new(std::size_t n) {
+    void* p = std::malloc(n + header);
+    if (!p)
+        throw std::bad_alloc();
+    *static_cast<std::size_t*>(p) = n;
+    live_bytes.fetch_add(n, std::memory_order_relaxed);
+    return static_cast<char*>(p) + header;
+}
+
+void operator delete(void* p) noexcept {
+    if (!p)
+        return;
+    void* block = static_cast<char*>(p) - header;
+    live_bytes.fetch_sub(*static_cast<std::size_t*>(block), std::memory_order_relaxed);
+    std::free(block);
+}
+
+void* operator new[](std::size_t n)                 { return operator new(n); }
+void  operator delete[](void* p) noexcept           { operator delete(p);     }
+void  operator delete(void* p, std::size_t) noexcept   { operator delete(p); }
+void  operator delete[](void* p, std::size_t) noexcept { operator delete(p); }
+
+namespace {
+    using lru_bench::workload;
+
+    const std::size_t trace_length = std::size_t(1) << 20;
+    const std::size_t sample_every = 16;
+
+    // Values of a given size.
+    template<std::size_t Bytes>
+    struct value_maker {
+        typedef std::string type;
+        static type        make(std::uint64_t n) { return std::string(Bytes, static_cast<char>('a' + n % 26)); }
+        static std::string name()                { return std::to_string(Bytes) + "B"; }
+    };
+
+    template<>
+    struct value_maker<8> {
+        typedef std::uint64_t type;
+        static type        make(std::uint64_t n) { return n; }
+        static std::string name()                { return "8B"; }
+    };
+
+    // The single-threaded and the sharded cache behind one interface.
+    template<class TKey, class TValue>
+    struct single {
+        typedef LRUCache<TKey, TValue> cache_type;
+
+        static const char* name() { return "single"; }
+
+        static inline bool get(cache_type& c, const TKey& key) {
+            auto pos = c.get(key);
+            if (pos == c.end())
+                return false;
+            benchmark::DoNotOptimize(pos->second);
+            return true;
+        }
+
+        static inline bool peek(const cache_type& c, const TKey& key) {
+            auto pos = c.peek(key);
+            if (pos == c.end())
+                return false;
+            benchmark::DoNotOptimize(pos->second);
+            return true;
+        }
+    };
+
+    template<class TKey, class TValue>
+    struct sharded {
+        typedef ShardedLRUCache<TKey, TValue, 16> cache_type;
+
+        static const char* name() { return "sharded"; }
+
+        static inline bool get(cache_type& c, const TKey& key) {
+            TValue value = TValue();
+            bool hit = c.get(key, value);
+            benchmark::DoNotOptimize(value);
+            return hit;
+        }
+
+        static inline bool peek(const cache_type& c, const TKey& key) {
+            TValue value = TValue();
+            bool hit = c.peek(key, value);
+            benchmark::DoNotOptimize(value);
+            return hit;
+        }
+    };
+
+    enum class operation { get_hit, get_miss, peek, put_update, put_evict, replay };
+
+    const char* name_of(operation op) {
+        switch (op){
+        case operation::get_hit:    return "get_hit";
+        case operation::get_miss:   return "get_miss";
+        case operation::peek:       return "peek";
+        case operation::put_update: return "put_update";
+        case operation::put_evict:  return "put_evict";
+        default:                    return "replay";
+        }
+    }
+
+    // Everything a benchmark shares between its threads and between the
+    // runs Google Benchmark makes of it, set up by thread 0 of the first.
+    template<class TAccess, class TKeys, class TValues>
+    struct fixture {
+        typedef typename TAccess::cache_type                              cache_type;
+        typedef typename std::decay<decltype(TKeys::make(0))>::type      key_type;
+        typedef typename TValues::type                                    value_type;
+
+        fixture(operation op, workload w, std::size_t capacity) : op(op), w(w), capacity(capacity) {
+            // replay draws from twice the capacity, the others from the cached
+            // keys, numbered below capacity, or from the uncached ones above;
+            // put_evict takes enough fresh keys that none is still cached
+            // when they come round again
+            std::uint32_t range = static_cast<std::uint32_t>(op == operation::replay ? capacity * 2 : capacity);
+            std::vector<std::uint32_t> trace = lru_bench::make_trace(w, range, trace_length);
+            std::uint64_t offset = op == operation::get_miss ? capacity : 0;
+            std::size_t length = op == operation::put_evict ? std::max(trace_length, 4 * capacity) : trace_length;
+            keys.reserve(length);
+            for (std::size_t i = 0; i < length; ++i)
+                keys.push_back(TKeys::make(op == operation::put_evict ? capacity + i : trace[i] + offset));
+            for (std::size_t i = 0; i < 64; ++i)
+                values.push_back(TValues::make(i));
+
+            // replay warms up on its own trace, the others start full
+            std::size_t before = live_bytes.load();
+            cache.reset(new cache_type(capacity));
+            if (op == operation::replay){
+                for (std::size_t i = 0; i < keys.size(); ++i)
+                    if (!TAccess::get(*cache, keys[i]))
+                        cache->put(keys[i], values[i % values.size()]);
+            }
+            else{
+                for (std::uint64_t n = 0; n < capacity; ++n)
+                    cache->put(TKeys::make(n), values[n % values.size()]);
+            }
+            bytes_per_entry = double(live_bytes.load() - before) / cache->size();
+        }
+
+        inline bool same(operation o, workload v, std::size_t c) const { return o == op && v == w && c == capacity; }
+
+        operation                   op;
+        workload                    w;
+        std::size_t                 capacity;
+        std::vector<key_type>       keys;
+        std::vector<value_type>     values;
+        std::unique_ptr<cache_type> cache;
+        double                      bytes_per_entry;
+    };
+
+    template<class TAccess, class TKeys, class TValues>
+    void run(benchmark::State& state, operation op, workload w, std::size_t capacity) {
+        typedef fixture<TAccess, TKeys, TValues> fixture_type;
+        static std::unique_ptr<fixture_type> shared;
+        static unsigned long long hits, misses;
+        if (state.thread_index() == 0){
+            if (!shared || !shared->same(op, w, capacity)){
+                shared.reset();
+                shared.reset(new fixture_type(op, w, capacity));
+            }
+            hits = shared->cache->cache_hits();
+            misses = shared->cache->cache_misses();
+        }
+
+        std::vector<std::uint32_t> samples;
+        samples.reserve(1 << 16);
+        std::size_t i = static_cast<std::size_t>(state.thread_index()) * (trace_length / 7);
+        for (auto _ : state){
+            fixture_type& f = *shared;
+            typename fixture_type::cache_type& cache = *f.cache;
+            const auto& key = f.keys[i % f.keys.size()];
+            const auto& value = f.values[i % f.values.size()];
+            bool sample = i % sample_every == 0;
+            std::chrono::steady_clock::time_point start;
+            if (sample)
+                start = std::chrono::steady_clock::now();
+
+            switch (op){
+            case operation::get_hit:
+            case operation::get_miss:   TAccess::get(cache, key);  break;
+            case operation::peek:       TAccess::peek(cache, key); break;
+            case operation::put_update:
+            case operation::put_evict:  cache.put(key, value);     break;
+            case operation::replay:
+                if (!TAccess::get(cache, key))
+                    cache.put(key, value);
+                break;
+            }
+
+            if (sample)
+                samples.push_back(static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count()));
+            ++i;
+        }
+        state.SetItemsProcessed(state.iterations());
+
+        // Per-thread percentiles, averaged over threads; the rest once, from thread 0.
+        if (!samples.empty()){
+            std::sort(samples.begin(), samples.end());
+            state.counters["p50_ns"] = benchmark::Counter(samples[samples.size() / 2], benchmark::Counter::kAvgThreads);
+            state.counters["p99_ns"] = benchmark::Counter(samples[samples.size() * 99 / 100], benchmark::Counter::kAvgThreads);
+        }
+        if (state.thread_index() == 0){
+            fixture_type& f = *shared;
+            unsigned long long h = f.cache->cache_hits() - hits, m = f.cache->cache_misses() - misses;
+            if (h + m)                  // get() ran
+                state.counters["hit_ratio"] = double(h) / (h + m);
+            state.counters["bytes_per_entry"] = f.bytes_per_entry;
+        }
+    }
+
+    template<template<class, class> class TAccess, class TKey, std::size_t ValueBytes>
+    void add(operation op, workload w, std::size_t capacity) {
+        typedef value_maker<ValueBytes>                         values;
+        typedef TAccess<TKey, typename values::type>            access;
+        typedef lru_bench::key_maker<TKey>                      keys;
+
+        std::string name = std::string(access::name()) + "/" + keys::name() + "/" + values::name() + "/" +
+                           name_of(op) + "/" + (op == operation::put_evict ? "fresh" : lru_bench::name_of(w)) +
+                           "/" + std::to_string(capacity);
+        benchmark::internal::Benchmark* b = benchmark::RegisterBenchmark(name.c_str(),
+            [=](benchmark::State& state) { run<access, keys, values>(state, op, w, capacity); });
+        if (std::string(access::name()) == "sharded")
+            b->Threads(1)->Threads(4);
+        b->UseRealTime();
+    }
+
+    const operation all_operations[] = { operation::get_hit, operation::get_miss, operation::peek,
+                                          operation::put_update, operation::replay };
+    const workload  all_workloads[] = { workload::uniform, workload::zipfian, workload::scan, workload::loop };
+
+    // Every operation under every workload for 64-bit keys and values; the
+    // other key and value sizes under zipfian only.
+    template<template<class, class> class TAccess>
+    void add_suite() {
+        const std::size_t capacities[] = { std::size_t(1) << 16, std::size_t(1) << 20 };
+        for (std::size_t capacity : capacities){
+            for (operation op : all_operations)
+                for (workload w : all_workloads)
+                    add<TAccess, std::uint64_t, 8>(op, w, capacity);
+            add<TAccess, std::uint64_t, 8>(operation::put_evict, workload::uniform, capacity);
+        }
+        std::size_t capacity = std::size_t(1) << 16;
+        for (operation op : all_operations){
+            add<TAccess, std::uint64_t, 100>(op, workload::zipfian, capacity);
+            add<TAccess, std::string, 8>(op, workload::zipfian, capacity);
+            add<TAccess, std::string, 100>(op, workload::zipfian, capacity);
+        }
+        add<TAccess, std::uint64_t, 100>(operation::put_evict, workload::uniform, capacity);
+        add<TAccess, std::string, 8>(operation::put_evict, workload::uniform, capacity);
+        add<TAccess, std::string, 100>(operation::put_evict, workload::uniform, capacity);
+    }
+}
+
+int main(int argc, char** argv) {
+    add_suite<single>();
+    add_suite<sharded>();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
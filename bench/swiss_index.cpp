@@ -0,0 +1,83 @@
+// swiss_index.cpp:
+// Hit-path benchmark of LRUCache's lookup indexes
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// Fills a cache of N 64-bit keys, then times get() of keys it holds, in a
+// random order so every lookup goes to memory, for each index:
+//
+//   list + map     std::list with the std::unordered_map index (the default)
+//   slab           LRUSlab with LRUSlabIndex
+//   swiss          LRUSwissSlab with LRUSwissIndex
+//
+// Build and run (sizes in millions of entries, 1 and 10 by default):
+//
+//     g++ -std=c++11 -O2 -I.. swiss_index.cpp -o swiss_index && ./swiss_index 1 10
+//
+#include "LRUSwissIndex.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+    typedef std::uint64_t key_type;
+    typedef std::uint64_t value_type;
+
+    const std::size_t lookups = 10000000;
+
+    template<class TCache>
+    double hit_ns(std::size_t n, const std::vector<key_type>& keys, const std::vector<key_type>& order) {
+        TCache cache(n);
+        for (std::size_t i = 0; i < n; ++i)
+            cache.put(keys[i], keys[i]);
+
+        value_type sum = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < order.size(); ++i)
+            sum += cache.get(order[i])->second;
+        std::chrono::steady_clock::duration took = std::chrono::steady_clock::now() - start;
+
+        if (cache.cache_hits() != order.size() || sum == 0)
+            std::printf("(unexpected misses)\n");
+        return std::chrono::duration<double, std::nano>(took).count() / order.size();
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::size_t> sizes;
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(static_cast<std::size_t>(std::atof(argv[i]) * 1000000));
+    if (sizes.empty()){
+        sizes.push_back(1000000);
+        sizes.push_back(10000000);
+    }
+
+    std::printf("%10s %14s %14s %14s %9s\n", "entries", "list+map ns", "slab ns", "swiss ns", "speedup");
+    for (std::size_t s = 0; s < sizes.size(); ++s){
+        std::size_t n = sizes[s];
+        std::mt19937_64 rng(n);
+        std::vector<key_type> keys(n);
+        for (std::size_t i = 0; i < n; ++i)
+            keys[i] = rng();
+        std::vector<key_type> order(lookups);
+        for (std::size_t i = 0; i < lookups; ++i)
+            order[i] = keys[rng() % n];
+
+        double map = hit_ns< LRUCache<key_type, value_type> >(n, keys, order);
+        double slab = hit_ns< LRUCache<key_type, value_type, LRUSlab< std::pair<key_type, value_type> > > >(n, keys, order);
+        double swiss = hit_ns< LRUCache<key_type, value_type, LRUSwissSlab< std::pair<key_type, value_type> > > >(n, keys, order);
+        std::printf("%10zu %14.1f %14.1f %14.1f %8.2fx\n", n, map, slab, swiss, map / swiss);
+    }
+    return 0;
+}
@@ -0,0 +1,149 @@
+// workloads.h:
+// Synthetic access traces for the LRUCache benchmarks
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// A trace is a sequence of key numbers in [0, keys). Benchmarks map the
+// numbers to keys of whatever type they test (see key_maker), so every type
+// sees the same access pattern:
+//
+//   uniform   every key equally likely
+//   zipfian   Zipf-distributed with skew 0.99 (as YCSB), the hot keys spread
+//             over the key space rather than numbered 0, 1, 2...
+//   scan      zipfian, interrupted every so often by a sequential sweep over
+//             a stretch of keys - the pattern scan-resistant policies target
+//   loop      0, 1, ..., keys - 1 over and over, which strict LRU misses
+//             entirely once keys exceeds the capacity
+//
+#ifndef LRU_BENCH_WORKLOADS_H
+#define LRU_BENCH_WORKLOADS_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace lru_bench {
+    enum class workload { uniform, zipfian, scan, loop };
+
+    inline const char* name_of(workload w) {
+        switch (w){
+        case workload::uniform: return "uniform";
+        case workload::zipfian: return "zipfian";
+        case workload::scan:    return "scan";
+        default:                return "loop";
+        }
+    }
+
+    // A bijection on 64-bit numbers (the murmur3 finalizer), to scatter key numbers.
+    inline std::uint64_t scramble(std::uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    // Gray et al.'s Zipf generator, as used by YCSB: constant time per draw
+    // after an O(keys) setup.
+    class zipf_generator {
+    public:
+        zipf_generator(std::uint64_t keys, double theta = 0.99) : keys_(keys), theta_(theta) {
+            zeta_n_ = zeta(keys, theta);
+            double zeta2 = zeta(2, theta);
+            alpha_ = 1.0 / (1.0 - theta);
+            eta_ = (1.0 - std::pow(2.0 / keys, 1.0 - theta)) / (1.0 - zeta2 / zeta_n_);
+        }
+
+        template<class TRng>
+        std::uint64_t operator()(TRng& rng) {
+            double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+            double uz = u * zeta_n_;
+            if (uz < 1.0)
+                return 0;
+            if (uz < 1.0 + std::pow(0.5, theta_))
+                return 1;
+            std::uint64_t k = static_cast<std::uint64_t>(keys_ * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+            return k < keys_ ? k : keys_ - 1;
+        }
+
+    private:
+        static double zeta(std::uint64_t n, double theta) {
+            double sum = 0;
+            for (std::uint64_t i = 1; i <= n; ++i)
+                sum += 1.0 / std::pow(static_cast<double>(i), theta);
+            return sum;
+        }
+
+        std::uint64_t keys_;
+        double        theta_;
+        double        zeta_n_;
+        double        alpha_;
+        double        eta_;
+    };
+
+    // length key numbers in [0, keys) following w.
+    inline std::vector<std::uint32_t> make_trace(workload w, std::uint32_t keys, std::size_t length,
+                                                 std::uint64_t seed = 42) {
+        std::vector<std::uint32_t> trace(length);
+        std::mt19937_64 rng(seed);
+        if (w == workload::uniform){
+            std::uniform_int_distribution<std::uint32_t> pick(0, keys - 1);
+            for (std::size_t i = 0; i < length; ++i)
+                trace[i] = pick(rng);
+            return trace;
+        }
+        if (w == workload::loop){
+            for (std::size_t i = 0; i < length; ++i)
+                trace[i] = static_cast<std::uint32_t>(i % keys);
+            return trace;
+        }
+        zipf_generator zipf(keys);
+        std::uint32_t sweep = 0;            // where the next scan picks up
+        std::size_t next_sweep = 8192;
+        for (std::size_t i = 0; i < length; ){
+            if (w == workload::scan && i >= next_sweep){
+                // a sweep as long as a sixteenth of the key space
+                for (std::size_t n = keys / 16 + 1; n-- > 0 && i < length; ++i)
+                    trace[i] = sweep++ % keys;
+                next_sweep = i + 8192;
+                continue;
+            }
+            trace[i++] = static_cast<std::uint32_t>(scramble(zipf(rng)) % keys);
+        }
+        return trace;
+    }
+
+    // Turns key numbers into keys: integers scattered over 64 bits, or
+    // 24-character strings (too long for the small-string buffer).
+    template<class TKey>
+    struct key_maker;
+
+    template<>
+    struct key_maker<std::uint64_t> {
+        static inline std::uint64_t make(std::uint64_t n) { return scramble(n); }
+        static inline const char*   name()                { return "u64"; }
+    };
+
+    template<>
+    struct key_maker<std::string> {
+        static std::string make(std::uint64_t n) {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "key:%020llu", static_cast<unsigned long long>(n));
+            return buffer;
+        }
+        static inline const char* name() { return "str24"; }
+    };
+}
+
+#endif // LRU_BENCH_WORKLOADS_H
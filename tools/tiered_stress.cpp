@@ -0,0 +1,172 @@
+// tiered_stress.cpp:
+// Hammers LRUTieredCache from several threads with its writer queue full
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// Every thread put()s and get()s random keys through a RAM tier of a few
+// dozen entries and a flash tier of tiny segments, so nearly every put()
+// demotes and the writer thread always lags: demotions keep waiting for
+// room in its queue while other threads promote and demote around them.
+// Each key belongs to one thread (key % threads), and each value names its
+// key and a version, bumped by every put(): a get() returning anything but
+// the owner's last put() - another key's value, or an older one - or a read
+// or decode failure (io_errors()), fails the run. Exits 0 on success, 1 on
+// failure.
+//
+//     tiered_stress [options]
+//
+//     --threads=N     default 8
+//     --ops=N         per thread (default 200000)
+//     --keys=N        drawn from [0, N) (default 5000)
+//     --ram=N         RAM tier entries (default 64)
+//     --segment=N     segment bytes (default 256)
+//     --segments=N    segments in the ring (default 64)
+//     --path=FILE     the flash file (default tiered_stress.log, unlinked at once)
+//
+// Build (add -fsanitize=thread or -fsanitize=address to check the locking):
+//
+//     g++ -std=c++14 -O2 -I.. tiered_stress.cpp -o tiered_stress -lpthread
+//
+#include "LRUTieredCache.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    typedef LRUTieredCache<std::uint64_t, std::string> cache_type;
+
+    struct options {
+        options() : threads(8), ops(200000), keys(5000), ram(64), segment(256), segments(64),
+                    path("tiered_stress.log") {}
+
+        unsigned      threads;
+        std::uint64_t ops;
+        std::uint64_t keys;
+        std::size_t   ram;
+        std::size_t   segment;
+        std::uint64_t segments;
+        std::string   path;
+    };
+
+    // "<key>:<version>:" then filler of a length that varies with the
+    // version, so records straddle segment boundaries at different points.
+    std::string value_for(std::uint64_t key, std::uint64_t version) {
+        std::string v = std::to_string(key) + ":" + std::to_string(version) + ":";
+        v.append(8 + version % 40, static_cast<char>('a' + version % 26));
+        return v;
+    }
+
+    bool is_value(const std::string& v, std::uint64_t key, std::uint64_t version) {
+        std::string prefix = std::to_string(key) + ":" + std::to_string(version) + ":";
+        return v.compare(0, prefix.size(), prefix) == 0;
+    }
+
+    std::uint64_t parse_count(const char* arg, const char* value) {
+        char* end;
+        unsigned long long n = std::strtoull(value, &end, 10);
+        if (*end || end == value)
+            throw std::invalid_argument(std::string("bad count: ") + arg);
+        return n;
+    }
+
+    options parse(int argc, char** argv) {
+        options opt;
+        for (int i = 1; i < argc; ++i){
+            std::string arg = argv[i];
+            std::size_t eq = arg.find('=');
+            if (eq == std::string::npos)
+                throw std::invalid_argument("unknown option: " + arg);
+            std::string name = arg.substr(0, eq);
+            const char* value = argv[i] + eq + 1;
+            if (name == "--threads")       opt.threads = static_cast<unsigned>(parse_count(argv[i], value));
+            else if (name == "--ops")      opt.ops = parse_count(argv[i], value);
+            else if (name == "--keys")     opt.keys = parse_count(argv[i], value);
+            else if (name == "--ram")      opt.ram = static_cast<std::size_t>(parse_count(argv[i], value));
+            else if (name == "--segment")  opt.segment = static_cast<std::size_t>(parse_count(argv[i], value));
+            else if (name == "--segments") opt.segments = parse_count(argv[i], value);
+            else if (name == "--path")     opt.path = value;
+            else throw std::invalid_argument("unknown option: " + arg);
+        }
+        if (!opt.threads || !opt.keys || !opt.ram)
+            throw std::invalid_argument("threads, keys and ram must be at least 1");
+        if (opt.keys < opt.threads)
+            throw std::invalid_argument("keys must be at least threads");
+        return opt;
+    }
+}
+
+int main(int argc, char** argv) {
+    options opt;
+    try{
+        opt = parse(argc, argv);
+    }
+    catch (const std::exception& e){
+        std::fprintf(stderr, "tiered_stress: %s\nusage: tiered_stress [--threads=N] [--ops=N] [--keys=N] "
+                             "[--ram=N] [--segment=N] [--segments=N] [--path=FILE]\n", e.what());
+        return 2;
+    }
+
+    try{
+        cache_type cache(opt.ram, opt.path, opt.segment * opt.segments, opt.segment);
+        std::atomic<unsigned long long> wrong(0), hits(0);
+        std::vector<std::uint64_t> versions(opt.keys);      // per key: its last put(), 0 if none
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < opt.threads; ++t){
+            pool.emplace_back([&opt, &cache, &wrong, &hits, &versions, t]() {
+                // the keys of thread t are t, t + threads, ...; only it writes their versions
+                std::uint64_t owned = (opt.keys - t + opt.threads - 1) / opt.threads;
+                std::mt19937_64 rng(t + 1);
+                std::string v;
+                for (std::uint64_t n = 0; n < opt.ops; ++n){
+                    std::uint64_t key = t + rng() % owned * opt.threads;
+                    if (n % 3 == 0 && cache.get(key, v)){
+                        hits.fetch_add(1, std::memory_order_relaxed);
+                        if (!is_value(v, key, versions[key]))
+                            wrong.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    else{
+                        cache.put(key, value_for(key, ++versions[key]));
+                    }
+                }
+            });
+        }
+        for (std::thread& th : pool)
+            th.join();
+
+        // Quiescent now: whatever is_cached() reports must come back from get(),
+        // as last put().
+        std::string v;
+        for (std::uint64_t key = 0; key < opt.keys; ++key){
+            if (!cache.is_cached(key))
+                continue;
+            if (!cache.get(key, v) || !is_value(v, key, versions[key]))
+                ++wrong;
+        }
+        std::printf("ram %zu  flash %zu  hits %llu  flash hits %llu  demotions %llu  flash evictions %llu\n"
+                    "io errors %llu  wrong values %llu\n",
+                    cache.ram_size(), cache.flash_size(), hits.load(), cache.flash_hits(), cache.demotion_count(),
+                    cache.flash_evictions(), cache.io_errors(), wrong.load());
+        if (cache.io_errors() || wrong.load()){
+            std::fprintf(stderr, "tiered_stress: FAILED\n");
+            return 1;
+        }
+    }
+    catch (const std::exception& e){
+        std::fprintf(stderr, "tiered_stress: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,299 @@
+// trace_replay.cpp:
+// Replays an access trace through LRUCache at several capacities and policies
+//
+// <copyright>
+// Copyright (c) 2017 David Starr
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// </copyright>
+//
+// Each access is a get() and, on a miss, a put() - a read-through cache -
+// for every combination of the capacities and policies given, each with a
+// cache of its own on a thread from a pool. The trace is mapped, not read,
+// so every thread streams it straight from the page cache. The hit-ratio
+// curve printed at the end comes from the caches' own counters:
+// cache_hits(), cache_misses() and bounce_count().
+//
+//     trace_replay [options] trace
+//
+//     --format=u64|u32|csv    binary keys of 8 or 4 bytes (native byte order)
+//                             or CSV; default csv for *.csv files, else u64
+//     --column=N              CSV: the key's column, from 0 (default 0); any
+//                             text, hashed to 64 bits
+//     --capacities=LIST       entry counts, k/M/G allowed (default 1k,10k,100k,1M)
+//     --policies=LIST         strict,clock,segmented,tinylfu (default all)
+//     --warmup=N              accesses replayed before counting starts
+//     --limit=N               stop after N accesses
+//     --threads=N             default: one per core
+//
+// Build:
+//
+//     g++ -std=c++14 -O2 -I.. trace_replay.cpp -o trace_replay -lpthread
+//
+#include "LRUSwissIndex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    typedef std::uint64_t key_type;
+    typedef LRUCache<key_type, std::uint8_t, LRUSwissSlab< std::pair<key_type, std::uint8_t> > > cache_type;
+
+    enum class trace_format { u64, u32, csv };
+
+    struct options {
+        options() : format(trace_format::u64), column(0), warmup(0), limit(std::uint64_t(-1)),
+                    threads(std::max(1u, std::thread::hardware_concurrency())) {}
+
+        std::string                 path;
+        trace_format                format;
+        std::size_t                 column;
+        std::vector<std::size_t>    capacities;
+        std::vector<LRUPolicy>      policies;
+        std::uint64_t               warmup;
+        std::uint64_t               limit;
+        unsigned                    threads;
+    };
+
+    // One capacity and policy, and what replaying the trace through it gave.
+    struct job {
+        std::size_t        capacity;
+        LRUPolicy          policy;
+        unsigned long long accesses;
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned long long bounces;
+        double             seconds;
+    };
+
+    const char* name_of(LRUPolicy p) {
+        switch (p){
+        case LRUPolicy::strict:    return "strict";
+        case LRUPolicy::clock:     return "clock";
+        case LRUPolicy::segmented: return "segmented";
+        default:                   return "tinylfu";
+        }
+    }
+
+    // Walks the keys of a mapped trace. CSV fields are hashed with FNV-1a;
+    // blank lines, and lines too short to have the column, are skipped.
+    class trace_reader {
+    public:
+        trace_reader(const char* data, std::size_t size, trace_format format, std::size_t column)
+            : p_(data), end_(data + size), format_(format), column_(column) {}
+
+        inline bool next(key_type& key) {
+            switch (format_){
+            case trace_format::u64: return fixed<std::uint64_t>(key);
+            case trace_format::u32: return fixed<std::uint32_t>(key);
+            default:                return csv(key);
+            }
+        }
+
+    private:
+        template<class T>
+        inline bool fixed(key_type& key) {
+            if (static_cast<std::size_t>(end_ - p_) < sizeof(T))
+                return false;
+            T k;
+            std::memcpy(&k, p_, sizeof(T));
+            p_ += sizeof(T);
+            key = k;
+            return true;
+        }
+
+        inline bool csv(key_type& key) {
+            while (p_ < end_){
+                const char* eol = static_cast<const char*>(std::memchr(p_, '\n', end_ - p_));
+                if (!eol)
+                    eol = end_;
+                const char* field = p_;
+                for (std::size_t c = 0; c < column_ && field < eol; ++c){
+                    field = static_cast<const char*>(std::memchr(field, ',', eol - field));
+                    field = field ? field + 1 : eol;
+                }
+                p_ = eol + (eol < end_);
+                if (field == eol)               // blank, or no such column
+                    continue;
+                std::uint64_t h = 0xcbf29ce484222325ULL;
+                for (; field < eol && *field != ',' && *field != '\r'; ++field)
+                    h = (h ^ static_cast<unsigned char>(*field)) * 0x100000001b3ULL;
+                key = h;
+                return true;
+            }
+            return false;
+        }
+
+        const char*  p_;
+        const char*  end_;
+        trace_format format_;
+        std::size_t  column_;
+    };
+
+    void replay(const lru_detail::mapped_file& trace, const options& opt, job& j) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        cache_type cache(j.capacity, LRUReserveIndex(), j.policy);
+        trace_reader reader(trace.data(), trace.size(), opt.format, opt.column);
+        key_type key;
+        std::uint64_t n = 0;
+        for (; n < opt.limit && reader.next(key); ++n){
+            if (n == opt.warmup)
+                cache.reset_stats();
+            if (cache.get(key) == cache.end())
+                cache.put(key, 0);
+        }
+        if (n <= opt.warmup)
+            cache.reset_stats();
+        j.accesses = n > opt.warmup ? n - opt.warmup : 0;
+        j.hits = cache.cache_hits();
+        j.misses = cache.cache_misses();
+        j.bounces = cache.bounce_count();
+        j.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::uint64_t parse_count(const std::string& s) {
+        char* end;
+        double v = std::strtod(s.c_str(), &end);
+        switch (*end){
+        case 'k': case 'K': v *= 1e3; break;
+        case 'm': case 'M': v *= 1e6; break;
+        case 'g': case 'G': v *= 1e9; break;
+        case 0:             break;
+        default:            throw std::invalid_argument("bad count: " + s);
+        }
+        return static_cast<std::uint64_t>(v);
+    }
+
+    std::vector<std::string> split(const std::string& s) {
+        std::vector<std::string> parts;
+        for (std::size_t at = 0; at <= s.size(); ){
+            std::size_t comma = std::min(s.find(',', at), s.size());
+            parts.push_back(s.substr(at, comma - at));
+            at = comma + 1;
+        }
+        return parts;
+    }
+
+    LRUPolicy parse_policy(const std::string& s) {
+        const LRUPolicy all[] = { LRUPolicy::strict, LRUPolicy::clock, LRUPolicy::segmented, LRUPolicy::tinylfu };
+        for (LRUPolicy p : all)
+            if (s == name_of(p))
+                return p;
+        throw std::invalid_argument("unknown policy: " + s);
+    }
+
+    options parse(int argc, char** argv) {
+        options opt;
+        bool format_given = false;
+        for (int i = 1; i < argc; ++i){
+            std::string arg = argv[i];
+            std::size_t eq = arg.find('=');
+            std::string name = arg.substr(0, eq), value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+            if (arg.compare(0, 2, "--") != 0){
+                opt.path = arg;
+            }
+            else if (name == "--format"){
+                format_given = true;
+                if (value == "u64")      opt.format = trace_format::u64;
+                else if (value == "u32") opt.format = trace_format::u32;
+                else if (value == "csv") opt.format = trace_format::csv;
+                else throw std::invalid_argument("unknown format: " + value);
+            }
+            else if (name == "--column")     opt.column = static_cast<std::size_t>(parse_count(value));
+            else if (name == "--warmup")     opt.warmup = parse_count(value);
+            else if (name == "--limit")      opt.limit = parse_count(value);
+            else if (name == "--threads")    opt.threads = std::max<unsigned>(1, static_cast<unsigned>(parse_count(value)));
+            else if (name == "--capacities"){
+                for (const std::string& c : split(value))
+                    opt.capacities.push_back(static_cast<std::size_t>(parse_count(c)));
+            }
+            else if (name == "--policies"){
+                for (const std::string& p : split(value))
+                    opt.policies.push_back(parse_policy(p));
+            }
+            else throw std::invalid_argument("unknown option: " + arg);
+        }
+        if (opt.path.empty())
+            throw std::invalid_argument("no trace given");
+        if (!format_given && opt.path.size() >= 4 && opt.path.compare(opt.path.size() - 4, 4, ".csv") == 0)
+            opt.format = trace_format::csv;
+        if (opt.capacities.empty())
+            opt.capacities = { 1000, 10000, 100000, 1000000 };
+        if (opt.policies.empty())
+            opt.policies = { LRUPolicy::strict, LRUPolicy::clock, LRUPolicy::segmented, LRUPolicy::tinylfu };
+        for (std::size_t c : opt.capacities)
+            if (c == 0)
+                throw std::invalid_argument("capacities must be at least 1");
+        return opt;
+    }
+}
+
+int main(int argc, char** argv) {
+    options opt;
+    try{
+        opt = parse(argc, argv);
+    }
+    catch (const std::exception& e){
+        std::fprintf(stderr, "trace_replay: %s\nusage: trace_replay [--format=u64|u32|csv] [--column=N] "
+                             "[--capacities=LIST] [--policies=LIST] [--warmup=N] [--limit=N] [--threads=N] trace\n",
+                     e.what());
+        return 2;
+    }
+
+    std::vector<job> jobs;
+    for (std::size_t c : opt.capacities)
+        for (LRUPolicy p : opt.policies)
+            jobs.push_back(job{ c, p, 0, 0, 0, 0, 0 });
+
+    try{
+        lru_detail::mapped_file trace(opt.path);
+        std::atomic<std::size_t> next(0);
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < std::min<std::size_t>(opt.threads, jobs.size()); ++t){
+            pool.emplace_back([&]() {
+                for (std::size_t i; (i = next.fetch_add(1)) < jobs.size(); ){
+                    replay(trace, opt, jobs[i]);
+                    std::fprintf(stderr, "%12zu %-10s %6.1fs  %.1fM accesses/s\n", jobs[i].capacity,
+                                 name_of(jobs[i].policy), jobs[i].seconds,
+                                 jobs[i].accesses / jobs[i].seconds / 1e6);
+                }
+            });
+        }
+        for (std::thread& t : pool)
+            t.join();
+    }
+    catch (const std::exception& e){
+        std::fprintf(stderr, "trace_replay: %s\n", e.what());
+        return 1;
+    }
+
+    // The curve: one row per capacity, hit ratios side by side, then the detail.
+    std::printf("%12s", "capacity");
+    for (LRUPolicy p : opt.policies)
+        std::printf(" %10s", name_of(p));
+    std::printf("\n");
+    for (std::size_t c = 0; c < opt.capacities.size(); ++c){
+        std::printf("%12zu", opt.capacities[c]);
+        for (std::size_t p = 0; p < opt.policies.size(); ++p){
+            const job& j = jobs[c * opt.policies.size() + p];
+            std::printf(" %10.4f", j.hits + j.misses ? double(j.hits) / (j.hits + j.misses) : 0.0);
+        }
+        std::printf("\n");
+    }
+    std::printf("\n%12s %-10s %14s %14s %14s %14s\n", "capacity", "policy", "accesses", "hits", "misses", "bounces");
+    for (const job& j : jobs)
+        std::printf("%12zu %-10s %14llu %14llu %14llu %14llu\n", j.capacity, name_of(j.policy),
+                    j.accesses, j.hits, j.misses, j.bounces);
+    return 0;
+}